@@ -0,0 +1,57 @@
+#include "boot_time.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+static const char *phase_names[BOOT_PHASE_COUNT] = {
+#define BOOT_PHASE_NAME(name) #name,
+    BOOT_PHASES(BOOT_PHASE_NAME)
+};
+
+//esp_timer time of every phase [us], 0 until it is reached
+static int64_t phase_us[BOOT_PHASE_COUNT];
+static portMUX_TYPE phase_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_time_mark(boot_phase phase)
+{
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&phase_spinlock);
+    if(phase_us[phase] == 0)
+    {
+        phase_us[phase] = now_us;
+    }
+    taskEXIT_CRITICAL(&phase_spinlock);
+}
+
+size_t boot_time_report(char *buffer)
+{
+    int64_t snapshot[BOOT_PHASE_COUNT];
+    taskENTER_CRITICAL(&phase_spinlock);
+    for(int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        snapshot[i] = phase_us[i];
+    }
+    taskEXIT_CRITICAL(&phase_spinlock);
+
+    int len = snprintf(buffer, BOOT_TIME_REPORT_SIZE, "#boot");
+    for(int i = 0; i < BOOT_PHASE_COUNT && len < BOOT_TIME_REPORT_SIZE; i++)
+    {
+        if(snapshot[i] == 0)
+        {
+            len += snprintf(buffer + len, BOOT_TIME_REPORT_SIZE - len, " %s=-", phase_names[i]);
+        }
+        else
+        {
+            len += snprintf(buffer + len, BOOT_TIME_REPORT_SIZE - len, " %s=%"PRId64, phase_names[i], snapshot[i]);
+        }
+    }
+    if(len > BOOT_TIME_REPORT_SIZE - 2)
+    {
+        len = BOOT_TIME_REPORT_SIZE - 2;
+    }
+    buffer[len++] = '\n';
+    buffer[len] = '\0';
+    return len;
+}
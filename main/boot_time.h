@@ -0,0 +1,77 @@
+/** @file boot_time.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Timestamps of the boot phases, reported to every client.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details app_main() only brings up the real-time path: the sensors, the actuators and the
+ * pipeline tasks, the control tasks are created first. NVS, Wi-Fi and the listening socket are
+ * brought up by tcp_server_task() in the background, so the throttle is passed through within
+ * milliseconds of power-on, whether an access point is in range or not. Wi-Fi then keeps
+ * reconnecting with a backoff, see wifi_station.h.
+ *
+ * Each phase of #BOOT_PHASES is timestamped with #boot_time_mark() when it is first reached,
+ * and the tcp server sends the timestamps to every client in a <b>#boot</b> line after the csv
+ * header. NVS and the Wi-Fi driver read the flash while the control tasks already run, each
+ * read suspends the flash cache of both cores for a moment, the jitter of the first periods
+ * includes these stalls.
+ */
+#ifndef BOOT_TIME_H
+#define BOOT_TIME_H
+
+#include <stddef.h>
+
+/** @def BOOT_PHASES
+ * @brief X(name) of every boot phase in the order they are expected to be reached
+ *
+ * @details app_main: app_main() is entered, sensors: sensors and actuators are initialised,
+ * control: output_compute_task() starts its first control period, nvs: NVS is initialised,
+ * wifi_start: the Wi-Fi station is started, wifi_ip: the first IP address is obtained,
+ * listen: the tcp server listens, client: the first client is accepted.
+ */
+#define BOOT_PHASES(X) \
+    X(app_main)        \
+    X(sensors)         \
+    X(control)         \
+    X(nvs)             \
+    X(wifi_start)      \
+    X(wifi_ip)         \
+    X(listen)          \
+    X(client)
+
+/** @def BOOT_TIME_REPORT_SIZE
+ * @brief A boot report including the terminating null character needs to fit in.
+ */
+#define BOOT_TIME_REPORT_SIZE 192
+
+/**
+ * @brief Identify a phase of #BOOT_PHASES.
+ */
+typedef enum boot_phase{
+#define BOOT_PHASE_ENUMERATOR(name) BOOT_PHASE_##name,
+    BOOT_PHASES(BOOT_PHASE_ENUMERATOR)
+#undef BOOT_PHASE_ENUMERATOR
+    BOOT_PHASE_COUNT
+} boot_phase;
+
+/**
+ * @brief Timestamp a phase with the esp_timer time, only the first call of each phase counts.
+ *
+ * @details Safe from any task, it takes a spinlock for a few instructions and does not log.
+ *
+ * @param phase - phase reached
+ */
+void boot_time_mark(boot_phase phase);
+
+/**
+ * @brief Format a <b>#boot</b> line with the esp_timer time every phase was reached at in us,
+ * phases not reached yet are reported as -.
+ *
+ * @param buffer - destination of at least #BOOT_TIME_REPORT_SIZE bytes
+ * @return length of the line
+ */
+size_t boot_time_report(char *buffer);
+
+#endif //__BOOT_TIME_H__
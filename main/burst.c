@@ -0,0 +1,388 @@
+#include "burst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#if CONFIG_RC_CAR_BURST_CAPTURE
+
+//longest event line: "#ev", two uint32 values, the longest sensor name and the edge
+#define BURST_EVENT_LINE_MAX 64
+//longest end line
+#define BURST_END_LINE_MAX 32
+
+static const char *const trigger_names[BURST_TRIGGER_COUNT] = {
+#define BURST_TRIGGER_NAME(name, default_threshold, description) #name,
+    BURST_TRIGGERS(BURST_TRIGGER_NAME)
+};
+
+/* recording: events are written into the active ring
+ * post:      a trigger fired, recording continues until the end of the post window
+ * frozen:    the rings are swapped, the frozen one waits for the tcp server, a new trigger replaces it
+ * uploading: the tcp server uploads the frozen ring, triggers are ignored */
+typedef enum burst_state{
+    BURST_RECORDING,
+    BURST_POST,
+    BURST_FROZEN,
+    BURST_UPLOADING,
+} burst_state;
+
+static const char *const state_names[] = {
+    [BURST_RECORDING] = "recording",
+    [BURST_POST] = "post",
+    [BURST_FROZEN] = "frozen",
+    [BURST_UPLOADING] = "uploading",
+};
+
+typedef struct burst_config{
+    uint32_t pre_ms;
+    uint32_t post_ms;
+    float thresholds[BURST_TRIGGER_COUNT];
+} burst_config;
+
+static burst_config config = {
+    .pre_ms = BURST_PRE_MS,
+    .post_ms = BURST_POST_MS,
+    .thresholds = {
+#define BURST_TRIGGER_DEFAULT(name, default_threshold, description) default_threshold,
+        BURST_TRIGGERS(BURST_TRIGGER_DEFAULT)
+    },
+};
+static portMUX_TYPE config_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static volatile burst_state state = BURST_RECORDING;
+
+_Static_assert((BURST_RING_LEN & (BURST_RING_LEN - 1)) == 0, "BURST_RING_LEN must be a power of two");
+
+typedef struct burst_ring{
+    burst_event events[BURST_RING_LEN];
+    //number of events written, the ring holds the last BURST_RING_LEN of them
+    uint32_t head;
+    //low 32 bits of the esp_timer time the ring started recording at [us]
+    uint32_t start_us;
+} burst_ring;
+
+//one ring records while the other one is frozen
+static burst_ring rings[2];
+static volatile uint8_t active = 0;
+static portMUX_TYPE ring_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+//the frozen burst, written by measurements_task while the state is post, read by the tcp server
+//once it is frozen
+static struct {
+    uint32_t id;
+    burst_trigger trigger;
+    int64_t trigger_us;
+    uint32_t pre_ms;
+    uint32_t post_ms;
+    //ring indices of the first and one past the last event of the window
+    uint32_t first;
+    uint32_t end;
+    uint32_t events;
+    bool truncated;
+} burst;
+//frozen bursts replaced by a newer trigger before their upload started
+static uint32_t replaced = 0;
+//upload position, UINT32_MAX if the begin line is not sent yet, used by the tcp server only
+static uint32_t upload_cursor = UINT32_MAX;
+
+void IRAM_ATTR burst_record_isr(sensor_id sensor, burst_edge edge, uint32_t cap_ticks)
+{
+    burst_event event = {
+        .time_us = (uint32_t)esp_timer_get_time(),
+        .cap_ticks = cap_ticks,
+        .sensor = sensor,
+        .edge = edge,
+    };
+    taskENTER_CRITICAL_ISR(&ring_spinlock);
+    burst_ring *ring = &rings[active];
+    ring->events[ring->head++ & (BURST_RING_LEN - 1)] = event;
+    taskEXIT_CRITICAL_ISR(&ring_spinlock);
+}
+
+//triggers of BURST_TRIGGERS, previous is the sample of the last period
+static inline bool distance_fires(const measurements_data *previous, const measurements_data *data, float threshold)
+{
+    return previous->distance >= threshold && data->distance < threshold;
+}
+static inline bool rpm_step_fires(const measurements_data *previous, const measurements_data *data, float threshold)
+{
+    return fabsf(data->rot_velocity - previous->rot_velocity) >= threshold;
+}
+static inline bool throttle_step_fires(const measurements_data *previous, const measurements_data *data, float threshold)
+{
+    return fabsf(data->throttle_in_duty - previous->throttle_in_duty) >= threshold;
+}
+
+//swap the rings and locate the window in the frozen one
+static void freeze(void)
+{
+    taskENTER_CRITICAL(&ring_spinlock);
+    const burst_ring *ring = &rings[active];
+    active ^= 1;
+    rings[active].head = 0;
+    rings[active].start_us = (uint32_t)esp_timer_get_time();
+    taskEXIT_CRITICAL(&ring_spinlock);
+    uint32_t window_start = (uint32_t)(burst.trigger_us - burst.pre_ms * 1000);
+    uint32_t window_end = (uint32_t)(burst.trigger_us + burst.post_ms * 1000);
+    uint32_t oldest = ring->head > BURST_RING_LEN ? ring->head - BURST_RING_LEN : 0;
+    burst.first = ring->head;
+    burst.end = ring->head;
+    //times wrap around, they are compared by their signed difference
+    for(uint32_t i = oldest; i < ring->head; i++)
+    {
+        uint32_t time_us = ring->events[i & (BURST_RING_LEN - 1)].time_us;
+        if((int32_t)(time_us - window_start) >= 0 && burst.first == ring->head)
+        {
+            burst.first = i;
+        }
+        if((int32_t)(time_us - window_end) <= 0)
+        {
+            burst.end = i + 1;
+        }
+    }
+    if(burst.end < burst.first)
+    {
+        burst.end = burst.first;
+    }
+    burst.events = burst.end - burst.first;
+    //overwritten events may have belonged to the window, or the window started before the ring
+    burst.truncated = (burst.first == oldest && ring->head > BURST_RING_LEN) ||
+                      (int32_t)(ring->start_us - window_start) > 0;
+    //the window is published to the tcp server with the state
+    taskENTER_CRITICAL(&ring_spinlock);
+    state = BURST_FROZEN;
+    taskEXIT_CRITICAL(&ring_spinlock);
+}
+
+void burst_check(const measurements_data *data)
+{
+    static measurements_data previous;
+    static bool has_previous = false;
+    static int64_t post_end_us = 0;
+    burst_config current;
+    taskENTER_CRITICAL(&config_spinlock);
+    current = config;
+    taskEXIT_CRITICAL(&config_spinlock);
+    int64_t now_us = esp_timer_get_time();
+    if((state == BURST_RECORDING || state == BURST_FROZEN) && has_previous)
+    {
+        burst_trigger fired = BURST_TRIGGER_COUNT;
+#define BURST_TRIGGER_CHECK(name, default_threshold, description)                     \
+        if(fired == BURST_TRIGGER_COUNT && current.thresholds[BURST_TRIGGER_##name] > 0 && \
+           name##_fires(&previous, data, current.thresholds[BURST_TRIGGER_##name]))      \
+        {                                                                               \
+            fired = BURST_TRIGGER_##name;                                               \
+        }
+        BURST_TRIGGERS(BURST_TRIGGER_CHECK)
+        //a frozen burst is replaced unless the tcp server has started to upload it, so a car
+        //running without a client keeps the latest burst
+        bool replace = false;
+        if(fired != BURST_TRIGGER_COUNT)
+        {
+            taskENTER_CRITICAL(&ring_spinlock);
+            replace = state == BURST_FROZEN;
+            if(state == BURST_RECORDING || replace)
+            {
+                state = BURST_POST;
+            }
+            else
+            {
+                //the tcp server claimed the burst since the state was read
+                fired = BURST_TRIGGER_COUNT;
+            }
+            taskEXIT_CRITICAL(&ring_spinlock);
+        }
+        if(fired != BURST_TRIGGER_COUNT)
+        {
+            if(replace)
+            {
+                replaced++;
+            }
+            burst.id++;
+            burst.trigger = fired;
+            burst.trigger_us = now_us;
+            burst.pre_ms = current.pre_ms;
+            burst.post_ms = current.post_ms;
+            post_end_us = now_us + current.post_ms * 1000;
+        }
+    }
+    else if(state == BURST_POST && now_us >= post_end_us)
+    {
+        freeze();
+    }
+    previous = *data;
+    has_previous = true;
+}
+
+void burst_upload_restart(void)
+{
+    //an interrupted upload starts over, until then a newer trigger may replace the burst
+    taskENTER_CRITICAL(&ring_spinlock);
+    if(state == BURST_UPLOADING)
+    {
+        state = BURST_FROZEN;
+    }
+    taskEXIT_CRITICAL(&ring_spinlock);
+    upload_cursor = UINT32_MAX;
+}
+
+size_t burst_upload(char *buffer)
+{
+    if(state != BURST_FROZEN && state != BURST_UPLOADING)
+    {
+        return 0;
+    }
+    const burst_ring *ring = &rings[active ^ 1];
+    int len = 0;
+    if(upload_cursor == UINT32_MAX)
+    {
+        //claim the burst, from now on it is not replaced
+        taskENTER_CRITICAL(&ring_spinlock);
+        bool claimed = state == BURST_FROZEN;
+        if(claimed)
+        {
+            state = BURST_UPLOADING;
+        }
+        taskEXIT_CRITICAL(&ring_spinlock);
+        if(!claimed)
+        {
+            return 0;
+        }
+        len = snprintf(buffer, BURST_UPLOAD_SIZE,
+                       "#burst begin %"PRIu32" %s %"PRId64" %"PRIu32" %"PRIu32" %"PRIu32" %d\n",
+                       burst.id, trigger_names[burst.trigger], burst.trigger_us,
+                       burst.pre_ms, burst.post_ms, burst.events, burst.truncated);
+        upload_cursor = burst.first;
+    }
+    for(; upload_cursor < burst.end && len + BURST_EVENT_LINE_MAX <= BURST_UPLOAD_SIZE; upload_cursor++)
+    {
+        const burst_event *event = &ring->events[upload_cursor & (BURST_RING_LEN - 1)];
+        len += snprintf(buffer + len, BURST_UPLOAD_SIZE - len, "#ev %"PRIu32" %"PRIu32" %s %c\n",
+                        event->time_us, event->cap_ticks, sensors_name(event->sensor),
+                        event->edge == BURST_EDGE_RISING ? 'r' : 'f');
+    }
+    if(upload_cursor == burst.end && len + BURST_END_LINE_MAX <= BURST_UPLOAD_SIZE)
+    {
+        len += snprintf(buffer + len, BURST_UPLOAD_SIZE - len, "#burst end %"PRIu32"\n", burst.id);
+        upload_cursor = UINT32_MAX;
+        taskENTER_CRITICAL(&ring_spinlock);
+        state = BURST_RECORDING;
+        taskEXIT_CRITICAL(&ring_spinlock);
+    }
+    return len;
+}
+
+static size_t reply_config(char *reply)
+{
+    burst_config current;
+    taskENTER_CRITICAL(&config_spinlock);
+    current = config;
+    taskEXIT_CRITICAL(&config_spinlock);
+    int len = snprintf(reply, BURST_REPLY_SIZE, "#ok burst state=%s replaced=%"PRIu32" pre=%"PRIu32" post=%"PRIu32,
+                       state_names[state], replaced, current.pre_ms, current.post_ms);
+    for(burst_trigger trigger = 0; trigger < BURST_TRIGGER_COUNT && len < BURST_REPLY_SIZE; trigger++)
+    {
+        len += snprintf(reply + len, BURST_REPLY_SIZE - len, " %s=%g", trigger_names[trigger], current.thresholds[trigger]);
+    }
+    if(len > BURST_REPLY_SIZE - 2)
+    {
+        len = BURST_REPLY_SIZE - 2;
+    }
+    reply[len++] = '\n';
+    reply[len] = '\0';
+    return len;
+}
+
+//set a parameter, return error message or NULL on success
+static const char *set_parameter(const char *name, const char *arg)
+{
+    char *end = NULL;
+    float value = arg != NULL ? strtof(arg, &end) : NAN;
+    if(arg == NULL || *end != '\0' || !(value >= 0) || !isfinite(value))
+    {
+        return "invalid value";
+    }
+    //windows are checked before the conversion, a float out of the range of uint32_t is undefined
+    bool window = strcmp(name, "pre") == 0 || strcmp(name, "post") == 0;
+    if(window && value > BURST_WINDOW_MAX_MS)
+    {
+        return "window out of range";
+    }
+    burst_config current;
+    taskENTER_CRITICAL(&config_spinlock);
+    current = config;
+    taskEXIT_CRITICAL(&config_spinlock);
+    if(strcmp(name, "pre") == 0)
+    {
+        current.pre_ms = value;
+    }
+    else if(strcmp(name, "post") == 0)
+    {
+        current.post_ms = value;
+    }
+    else
+    {
+        burst_trigger trigger = 0;
+        while(trigger < BURST_TRIGGER_COUNT && strcmp(name, trigger_names[trigger]) != 0)
+        {
+            trigger++;
+        }
+        if(trigger == BURST_TRIGGER_COUNT)
+        {
+            return "unknown parameter";
+        }
+        current.thresholds[trigger] = value;
+    }
+    if((uint64_t)current.pre_ms + current.post_ms > BURST_WINDOW_MAX_MS)
+    {
+        return "window out of range";
+    }
+    taskENTER_CRITICAL(&config_spinlock);
+    config = current;
+    taskEXIT_CRITICAL(&config_spinlock);
+    return NULL;
+}
+
+size_t burst_command(char **saveptr, char *reply)
+{
+    const char *name = strtok_r(NULL, " \r\t", saveptr);
+    if(name != NULL)
+    {
+        const char *error = set_parameter(name, strtok_r(NULL, " \r\t", saveptr));
+        if(error != NULL)
+        {
+            return snprintf(reply, BURST_REPLY_SIZE, "#err %s\n", error);
+        }
+    }
+    return reply_config(reply);
+}
+
+#else
+
+void burst_record_isr(sensor_id sensor, burst_edge edge, uint32_t cap_ticks)
+{
+}
+
+void burst_check(const measurements_data *data)
+{
+}
+
+void burst_upload_restart(void)
+{
+}
+
+size_t burst_upload(char *buffer)
+{
+    return 0;
+}
+
+size_t burst_command(char **saveptr, char *reply)
+{
+    return snprintf(reply, BURST_REPLY_SIZE, "#err burst capture disabled\n");
+}
+
+#endif
@@ -0,0 +1,156 @@
+/** @file burst.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Burst recorder keeping the raw capture events around a trigger.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details The capture interrupts of the sensors record every edge with #BURST_RECORD_ISR():
+ * rising tachometer edges from an MCPWM capture channel sharing the tachometer input with the
+ * pulse counter, both edges of the throttle input PWM and both edges of the HC-SR04 echo, whose
+ * difference is the time of flight. Events hold the capture timer value and the low 32 bits of
+ * esp_timer time, and are written into a rolling ring of #BURST_RING_LEN events.
+ *
+ * measurements_task() evaluates the triggers of #BURST_TRIGGERS on every sample with
+ * #burst_check(). When one fires, recording goes on for the post-trigger window, then the ring
+ * is frozen by swapping it with a second ring, so recording continues while the frozen one is
+ * uploaded. The tcp server uploads the events of the pre/post window in the background with
+ * #burst_upload(), new triggers are ignored until the upload is complete. A frozen burst whose
+ * upload has not started, because no client is connected or the last one disconnected during
+ * the upload, is replaced by the next trigger, so the latest burst is kept. Burst ids count
+ * every trigger, the <b>burst</b> reply reports the number of replaced bursts.
+ *
+ * Upload lines:
+ * - <b>#burst begin</b> id trigger time pre post events truncated - time is the esp_timer time of
+ *   the trigger [us], truncated is 1 if the ring did not hold the whole pre-trigger window
+ * - <b>#ev</b> time cap_ticks sensor edge - one line per event, time is the low 32 bits of
+ *   esp_timer time [us], cap_ticks is the capture timer value at APB clock, edge is r or f
+ * - <b>#burst end</b> id
+ *
+ * Triggers and windows are set with the <b>burst</b> command of the control channel.
+ * Enabled with <b>RC_CAR_BURST_CAPTURE</b> under <b>RC Car Pipeline Configuration</b> in project
+ * configuration menu.
+ */
+#ifndef BURST_H
+#define BURST_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "sensors.h"
+
+#if CONFIG_RC_CAR_BURST_CAPTURE
+/** @def BURST_RING_LEN
+ * @brief events a ring holds, power of two
+ */
+#define BURST_RING_LEN CONFIG_RC_CAR_BURST_RING_LEN
+#endif
+/** @def BURST_PRE_MS
+ * @brief default window recorded before the trigger [ms]
+ */
+#define BURST_PRE_MS 200
+/** @def BURST_POST_MS
+ * @brief default window recorded after the trigger [ms]
+ */
+#define BURST_POST_MS 300
+/** @def BURST_WINDOW_MAX_MS
+ * @brief longest pre plus post window [ms]
+ */
+#define BURST_WINDOW_MAX_MS 5000
+/** @def BURST_REPLY_SIZE
+ * @brief A burst configuration reply including the terminating null character needs to fit in.
+ */
+#define BURST_REPLY_SIZE 128
+/** @def BURST_UPLOAD_SIZE
+ * @brief upload chunk the tcp server sends between two batches, fits the begin line
+ */
+#define BURST_UPLOAD_SIZE 1024
+
+/** @def BURST_TRIGGERS
+ * @brief X(name, default_threshold, description), a threshold of 0 disables the trigger
+ */
+#define BURST_TRIGGERS(X) \
+    X(distance,      0.3,  "distance falls below threshold [m]") \
+    X(rpm_step,      1000, "rot/min changes by threshold between two samples") \
+    X(throttle_step, 10,   "throttle in duty changes by threshold between two samples [%]")
+
+/**
+ * @brief Edge of a capture event.
+ */
+typedef enum burst_edge{
+    BURST_EDGE_RISING,
+    BURST_EDGE_FALLING,
+} burst_edge;
+
+/**
+ * @brief Raw capture event.
+ */
+typedef struct burst_event{
+    uint32_t time_us;
+    uint32_t cap_ticks;
+    uint8_t sensor;
+    uint8_t edge;
+} burst_event;
+
+/**
+ * @brief Identify a trigger of #BURST_TRIGGERS.
+ */
+typedef enum burst_trigger{
+#define BURST_TRIGGER_ENUMERATOR(name, default_threshold, description) BURST_TRIGGER_##name,
+    BURST_TRIGGERS(BURST_TRIGGER_ENUMERATOR)
+#undef BURST_TRIGGER_ENUMERATOR
+    BURST_TRIGGER_COUNT
+} burst_trigger;
+
+#if CONFIG_RC_CAR_BURST_CAPTURE
+/** @def BURST_RECORD_ISR
+ * @brief Record a capture event of sensor <b>name</b> of #SENSOR_REGISTRY from its interrupt.
+ */
+#define BURST_RECORD_ISR(name, edge, cap_ticks) burst_record_isr(SENSOR_ID_##name, edge, cap_ticks)
+#else
+#define BURST_RECORD_ISR(name, edge, cap_ticks) ((void)0)
+#endif
+
+/**
+ * @brief Write an event into the recording ring, called by #BURST_RECORD_ISR().
+ */
+void burst_record_isr(sensor_id sensor, burst_edge edge, uint32_t cap_ticks);
+
+/**
+ * @brief Evaluate the triggers on a new sample and freeze the ring at the end of the post window.
+ *
+ * @details Called by measurements_task() every period, a no-op if burst capture is disabled.
+ */
+void burst_check(const measurements_data *data);
+
+/**
+ * @brief Restart the upload of a frozen burst, called when a client connects or disconnects.
+ *
+ * @details Until the upload starts again a newer trigger may replace the burst.
+ */
+void burst_upload_restart(void);
+
+/**
+ * @brief Encode the next lines of the frozen burst.
+ *
+ * @details The ring is released for the next trigger once the end line is encoded.
+ *
+ * @param buffer - destination of at least #BURST_UPLOAD_SIZE bytes
+ * @return length of the encoded lines, 0 if there is nothing to upload
+ */
+size_t burst_upload(char *buffer);
+
+/**
+ * @brief Handle a <b>burst</b> command of the control channel.
+ *
+ * @details Without arguments the configuration is reported. <b>burst</b> <i>param value</i> sets
+ * <b>pre</b> or <b>post</b> [ms] or the threshold of a trigger of #BURST_TRIGGERS.
+ *
+ * @param saveptr - strtok_r() state of the command line after the command
+ * @param reply - destination of at least #BURST_REPLY_SIZE bytes
+ * @return length of the reply
+ */
+size_t burst_command(char **saveptr, char *reply);
+
+#endif //__BURST_H__
@@ -0,0 +1,136 @@
+#include "clock_sync.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+void clock_sync_reset(clock_sync *cs)
+{
+    assert(cs != NULL);
+    memset(cs, 0, sizeof(*cs));
+}
+
+size_t clock_sync_ping(clock_sync *cs, int64_t now_us, char *buffer)
+{
+    assert(cs != NULL && buffer != NULL);
+    cs->seq++;
+    cs->ping_us = now_us;
+    return snprintf(buffer, CLOCK_SYNC_MSG_SIZE, "#ping %"PRIu32" %"PRId64"\n", cs->seq, now_us);
+}
+
+//fit offset and drift to the samples with a delay close to the minimum
+static void update_estimate(clock_sync *cs)
+{
+    uint32_t n = cs->count < CLOCK_SYNC_HISTORY ? cs->count : CLOCK_SYNC_HISTORY;
+    int64_t min_delay = INT64_MAX;
+    for(uint32_t i = 0; i < n; i++)
+    {
+        if(cs->samples[i].delay_us < min_delay)
+        {
+            min_delay = cs->samples[i].delay_us;
+        }
+    }
+    int64_t margin = min_delay / 2 > CLOCK_SYNC_DELAY_MARGIN_US ? min_delay / 2 : CLOCK_SYNC_DELAY_MARGIN_US;
+    int64_t max_delay = min_delay + margin;
+    //offsets are fitted relative to a kept sample, absolute client times do not fit a double exactly
+    const clock_sync_sample *origin = NULL;
+    double sum_t = 0, sum_o = 0;
+    uint32_t kept = 0;
+    int64_t first_t = INT64_MAX, last_t = INT64_MIN;
+    for(uint32_t i = 0; i < n; i++)
+    {
+        const clock_sync_sample *s = &cs->samples[i];
+        if(s->delay_us > max_delay)
+        {
+            continue;
+        }
+        if(origin == NULL)
+        {
+            origin = s;
+        }
+        sum_t += s->time_us - origin->time_us;
+        sum_o += s->offset_us - origin->offset_us;
+        first_t = s->time_us < first_t ? s->time_us : first_t;
+        last_t = s->time_us > last_t ? s->time_us : last_t;
+        kept++;
+    }
+    double mean_t = sum_t / kept;
+    double mean_o = sum_o / kept;
+    double s_tt = 0, s_to = 0;
+    for(uint32_t i = 0; i < n; i++)
+    {
+        const clock_sync_sample *s = &cs->samples[i];
+        if(s->delay_us <= max_delay)
+        {
+            double dt = (s->time_us - origin->time_us) - mean_t;
+            double doff = (s->offset_us - origin->offset_us) - mean_o;
+            s_tt += dt * dt;
+            s_to += dt * doff;
+        }
+    }
+    double drift = 0;
+    if(kept >= 2 && last_t - first_t >= CLOCK_SYNC_MIN_SPAN_US && s_tt > 0)
+    {
+        drift = s_to / s_tt;
+        drift = fmax(-CLOCK_SYNC_MAX_DRIFT_PPB * 1e-9, fmin(CLOCK_SYNC_MAX_DRIFT_PPB * 1e-9, drift));
+    }
+    double sum_residual2 = 0;
+    for(uint32_t i = 0; i < n; i++)
+    {
+        const clock_sync_sample *s = &cs->samples[i];
+        if(s->delay_us <= max_delay)
+        {
+            double dt = (s->time_us - origin->time_us) - mean_t;
+            double residual = (s->offset_us - origin->offset_us) - mean_o - drift * dt;
+            sum_residual2 += residual * residual;
+        }
+    }
+    clock_sync_estimate *e = &cs->estimate;
+    e->ref_us = origin->time_us + llround(mean_t);
+    e->offset_us = origin->offset_us + llround(mean_o);
+    e->drift_ppb = lround(drift * 1e9);
+    //half of the best round trip bounds every sample, the scatter of the kept ones is added
+    e->error_us = min_delay / 2 + lround(2 * sqrt(sum_residual2 / kept));
+    e->synced = kept >= 3;
+}
+
+bool clock_sync_pong(clock_sync *cs, const char *line, int64_t t4_us)
+{
+    assert(cs != NULL && line != NULL);
+    uint32_t seq;
+    int64_t t1, t2, t3;
+    if(sscanf(line, "pong %"SCNu32" %"SCNd64" %"SCNd64" %"SCNd64, &seq, &t1, &t2, &t3) != 4)
+    {
+        return false;
+    }
+    int64_t delay = (t4_us - t1) - (t3 - t2);
+    //only the answer to the outstanding ping which is consistent in time is used,
+    //stale, repeated or mangled pongs would poison the fit
+    if(cs->ping_us == 0 || seq != cs->seq || t1 != cs->ping_us || t3 < t2 || delay < 0)
+    {
+        return false;
+    }
+    cs->ping_us = 0;
+    clock_sync_sample *s = &cs->samples[cs->count % CLOCK_SYNC_HISTORY];
+    s->time_us = t1 + (t4_us - t1) / 2;
+    s->offset_us = ((t2 - t1) + (t3 - t4_us)) / 2;
+    s->delay_us = delay;
+    cs->count++;
+    update_estimate(cs);
+    return true;
+}
+
+size_t clock_sync_report(const clock_sync *cs, char *buffer)
+{
+    assert(cs != NULL && buffer != NULL);
+    const clock_sync_estimate *e = &cs->estimate;
+    return snprintf(buffer, CLOCK_SYNC_MSG_SIZE, "#sync %"PRId64" %"PRId64" %"PRId32" %"PRIu32" %d\n",
+                    e->ref_us, e->offset_us, e->drift_ppb, e->error_us, e->synced);
+}
+
+int64_t clock_sync_to_client(const clock_sync *cs, int64_t device_us)
+{
+    assert(cs != NULL);
+    const clock_sync_estimate *e = &cs->estimate;
+    return device_us + e->offset_us + (device_us - e->ref_us) * e->drift_ppb / 1000000000;
+}
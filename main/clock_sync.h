@@ -0,0 +1,135 @@
+/** @file clock_sync.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief NTP style estimation of the offset and drift between the clock of the telemetry client
+ * and esp_timer_get_time().
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details Every #CLOCK_SYNC_PERIOD_MS the device sends <b>#ping</b> <i>seq t1</i> on the telemetry
+ * connection, t1 being the device time of sending. The client answers immediately with the command
+ * <b>pong</b> <i>seq t1 t2 t3</i>, t2 and t3 being its own clock when the ping was received and the
+ * pong was sent, all in microseconds. With t4, the device time of receiving the pong, each exchange
+ * gives an offset sample and a round trip delay:
+ * \f{equation}{offset = \frac{(t2 - t1) + (t3 - t4)}{2}, \quad delay = (t4 - t1) - (t3 - t2)\f}
+ * 
+ * The true offset is within offset +- delay/2 of a sample. Of the last #CLOCK_SYNC_HISTORY samples
+ * the ones with a delay close to the minimum are kept, which rejects exchanges delayed by Wi-Fi
+ * retransmissions or by the device polling the socket late. Offset and drift are a least squares
+ * line fit of the kept samples. After every exchange the estimate is reported to the client as
+ * <b>#sync</b> <i>ref_us offset_us drift_ppb error_us synced</i>, from which
+ * \f{equation}{client\_time = device\_time + offset + (device\_time - ref) * drift * 10^{-9}\f}
+ * holds within +-error.
+ * 
+ * The module has no esp-idf dependencies, timestamps are passed in by the caller.
+ */
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** @def CLOCK_SYNC_PERIOD_MS
+ * @brief time between two ping messages [ms]
+ */
+#define CLOCK_SYNC_PERIOD_MS 1000
+/** @def CLOCK_SYNC_TIMEOUT_MS
+ * @brief longest wait for a pong after a ping, the answer is timestamped when it arrives [ms]
+ */
+#define CLOCK_SYNC_TIMEOUT_MS 20
+/** @def CLOCK_SYNC_HISTORY
+ * @brief number of exchanges the estimate is fitted to
+ */
+#define CLOCK_SYNC_HISTORY 32
+/** @def CLOCK_SYNC_DELAY_MARGIN_US
+ * @brief samples with a delay up to this much above the minimum are always kept [us]
+ */
+#define CLOCK_SYNC_DELAY_MARGIN_US 500
+/** @def CLOCK_SYNC_MIN_SPAN_US
+ * @brief drift is fitted once the kept samples span this long [us]
+ */
+#define CLOCK_SYNC_MIN_SPAN_US 5000000
+/** @def CLOCK_SYNC_MAX_DRIFT_PPB
+ * @brief drift estimates are limited to the tolerance of the crystals [ppb]
+ */
+#define CLOCK_SYNC_MAX_DRIFT_PPB 500000
+/** @def CLOCK_SYNC_MSG_SIZE
+ * @brief A ping or sync message including the terminating null character needs to fit in.
+ */
+#define CLOCK_SYNC_MSG_SIZE 96
+
+/**
+ * @brief Result of a single ping-pong exchange.
+ */
+typedef struct clock_sync_sample{
+    int64_t time_us;   /**< device time in the middle of the exchange */
+    int64_t offset_us; /**< client time - device time */
+    int64_t delay_us;  /**< round trip delay without the processing time of the client */
+} clock_sync_sample;
+
+/**
+ * @brief Current estimate of the client clock.
+ */
+typedef struct clock_sync_estimate{
+    bool synced;       /**< at least three exchanges were kept */
+    int64_t ref_us;    /**< device time the offset refers to */
+    int64_t offset_us; /**< client time - device time at ref_us */
+    int32_t drift_ppb; /**< rate of change of the offset */
+    uint32_t error_us; /**< bound of the mapping error */
+} clock_sync_estimate;
+
+/**
+ * @brief State of the synchronisation with one client.
+ */
+typedef struct clock_sync{
+    uint32_t seq;
+    //send time of ping seq, 0 once it is answered
+    int64_t ping_us;
+    uint32_t count;
+    clock_sync_sample samples[CLOCK_SYNC_HISTORY];
+    clock_sync_estimate estimate;
+} clock_sync;
+
+/**
+ * @brief Forget every exchange, called when a new client connects.
+ */
+void clock_sync_reset(clock_sync *cs);
+
+/**
+ * @brief Format the next ping message.
+ * 
+ * @param cs - synchronisation state
+ * @param now_us - device time of sending
+ * @param buffer - destination of at least #CLOCK_SYNC_MSG_SIZE bytes
+ * @return length of the message
+ */
+size_t clock_sync_ping(clock_sync *cs, int64_t now_us, char *buffer);
+
+/**
+ * @brief Process a pong command and update the estimate.
+ * 
+ * @param cs - synchronisation state
+ * @param line - null terminated "pong seq t1 t2 t3" line
+ * @param t4_us - device time the line was received
+ * @return true if the exchange was valid and the estimate was updated, only the first answer to
+ * the last ping echoing its sequence number and send time is valid
+ */
+bool clock_sync_pong(clock_sync *cs, const char *line, int64_t t4_us);
+
+/**
+ * @brief Format the #sync message reporting the current estimate.
+ * 
+ * @param cs - synchronisation state
+ * @param buffer - destination of at least #CLOCK_SYNC_MSG_SIZE bytes
+ * @return length of the message
+ */
+size_t clock_sync_report(const clock_sync *cs, char *buffer);
+
+/**
+ * @brief Map a device timestamp to client time with the current estimate.
+ */
+int64_t clock_sync_to_client(const clock_sync *cs, int64_t device_us);
+
+#endif //__CLOCK_SYNC_H__
@@ -0,0 +1,229 @@
+#include "control_channel.h"
+#include "sensors.h"
+#include "cpu_load.h"
+#include "burst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static stream_config config = {
+    .loop_period_ms = LOOP_PERIOD_MS,
+    .format = OUTPUT_FORMAT_CSV,
+    .decimation = 1,
+    .batch_size = 1,
+};
+static portMUX_TYPE config_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const format_names[] = {
+    [OUTPUT_FORMAT_CSV] = "csv",
+    [OUTPUT_FORMAT_BIN] = "bin",
+};
+
+void stream_config_get(stream_config *out)
+{
+    assert(out != NULL);
+    taskENTER_CRITICAL(&config_spinlock);
+    *out = config;
+    taskEXIT_CRITICAL(&config_spinlock);
+}
+
+/* a rate is raised by old_period/new_period, the busiest core must stay below the limit,
+return error message or NULL if the change is allowed*/
+static const char *load_check(uint32_t old_period, uint32_t new_period)
+{
+    if(new_period >= old_period)
+    {
+        return NULL;
+    }
+    //without a complete measurement window the load is unknown, not zero
+    if(!cpu_load_valid())
+    {
+        return "cpu load not measured yet";
+    }
+    if((uint64_t)cpu_load_max_percent() * old_period > (uint64_t)CPU_LOAD_LIMIT_PERCENT * new_period)
+    {
+        return "cpu load limit";
+    }
+    return NULL;
+}
+
+static bool parse_uint(const char *token, uint32_t *value)
+{
+    if(token == NULL || *token == '\0')
+    {
+        return false;
+    }
+    char *end = NULL;
+    unsigned long parsed = strtoul(token, &end, 10);
+    if(*end != '\0' || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+static size_t reply_config(char *reply)
+{
+    stream_config current;
+    stream_config_get(&current);
+    int len = snprintf(reply, CONTROL_REPLY_SIZE, "#ok loop=%"PRIu32" format=%s decimation=%"PRIu32" batch=%"PRIu32,
+                       current.loop_period_ms, format_names[current.format], current.decimation, current.batch_size);
+    for(sensor_id id = 0; id < SENSOR_COUNT && len < CONTROL_REPLY_SIZE; id++)
+    {
+        len += snprintf(reply + len, CONTROL_REPLY_SIZE - len, " %s=%"PRIu32, sensors_name(id), sensors_get_period_ms(id));
+    }
+    for(int cpu = 0; cpu < portNUM_PROCESSORS && len < CONTROL_REPLY_SIZE; cpu++)
+    {
+        len += snprintf(reply + len, CONTROL_REPLY_SIZE - len, " load%d=%"PRIu32, cpu, cpu_load_percent(cpu));
+    }
+    if(len > CONTROL_REPLY_SIZE - 2)
+    {
+        len = CONTROL_REPLY_SIZE - 2;
+    }
+    reply[len++] = '\n';
+    reply[len] = '\0';
+    return len;
+}
+
+//execute a "set" command, return error message or NULL on success
+static const char *set_parameter(const char *name, char **saveptr)
+{
+    const char *arg = strtok_r(NULL, " \r\t", saveptr);
+    uint32_t value = 0;
+    if(name == NULL)
+    {
+        return "missing parameter";
+    }
+    if(strcmp(name, "rate") == 0)
+    {
+        sensor_id id = arg != NULL ? sensors_find(arg) : SENSOR_COUNT;
+        if(id == SENSOR_COUNT)
+        {
+            return "unknown sensor";
+        }
+        if(!parse_uint(strtok_r(NULL, " \r\t", saveptr), &value))
+        {
+            return "invalid period";
+        }
+        //invalid periods are reported as such, whatever the load is
+        esp_err_t err = sensors_check_period_ms(id, value);
+        const char *load_error = err == ESP_OK ? load_check(sensors_get_period_ms(id), value) : NULL;
+        if(load_error != NULL)
+        {
+            return load_error;
+        }
+        if(err == ESP_OK)
+        {
+            err = sensors_set_period_ms(id, value);
+        }
+        switch(err)
+        {
+            case ESP_OK: return NULL;
+            case ESP_ERR_NOT_SUPPORTED: return "sensor is capture driven";
+            case ESP_ERR_INVALID_ARG: return "period out of range";
+            default: return "timer error";
+        }
+    }
+    if(strcmp(name, "format") == 0)
+    {
+        for(output_format format = OUTPUT_FORMAT_CSV; format <= OUTPUT_FORMAT_BIN; format++)
+        {
+            if(arg != NULL && strcmp(arg, format_names[format]) == 0)
+            {
+                taskENTER_CRITICAL(&config_spinlock);
+                config.format = format;
+                taskEXIT_CRITICAL(&config_spinlock);
+                return NULL;
+            }
+        }
+        return "unknown format";
+    }
+    if(!parse_uint(arg, &value))
+    {
+        return "invalid value";
+    }
+    stream_config current;
+    stream_config_get(&current);
+    if(strcmp(name, "loop") == 0)
+    {
+        if(value < LOOP_PERIOD_MIN_MS || value > LOOP_PERIOD_MAX_MS || pdMS_TO_TICKS(value) == 0)
+        {
+            return "period out of range";
+        }
+        const char *load_error = load_check(current.loop_period_ms, value);
+        if(load_error != NULL)
+        {
+            return load_error;
+        }
+        current.loop_period_ms = value;
+    }
+    else if(strcmp(name, "decimation") == 0)
+    {
+        if(value < 1 || value > MAX_DECIMATION)
+        {
+            return "decimation out of range";
+        }
+        const char *load_error = load_check(current.decimation, value);
+        if(load_error != NULL)
+        {
+            return load_error;
+        }
+        current.decimation = value;
+    }
+    else if(strcmp(name, "batch") == 0)
+    {
+        if(value < 1 || value > MAX_BATCH)
+        {
+            return "batch out of range";
+        }
+        current.batch_size = value;
+    }
+    else
+    {
+        return "unknown parameter";
+    }
+    taskENTER_CRITICAL(&config_spinlock);
+    config = current;
+    taskEXIT_CRITICAL(&config_spinlock);
+    return NULL;
+}
+
+_Static_assert(BURST_REPLY_SIZE <= CONTROL_REPLY_SIZE, "burst replies are written into command replies");
+
+size_t control_handle_command(char *line, char *reply)
+{
+    assert(line != NULL && reply != NULL);
+    char *saveptr = NULL;
+    const char *command = strtok_r(line, " \r\t", &saveptr);
+    const char *error = NULL;
+    if(command == NULL)
+    {
+        error = "empty command";
+    }
+    else if(strcmp(command, "get") == 0)
+    {
+        return reply_config(reply);
+    }
+    else if(strcmp(command, "burst") == 0)
+    {
+        return burst_command(&saveptr, reply);
+    }
+    else if(strcmp(command, "set") == 0)
+    {
+        error = set_parameter(strtok_r(NULL, " \r\t", &saveptr), &saveptr);
+    }
+    else
+    {
+        error = "unknown command";
+    }
+    if(error != NULL)
+    {
+        return snprintf(reply, CONTROL_REPLY_SIZE, "#err %s\n", error);
+    }
+    return reply_config(reply);
+}
@@ -0,0 +1,109 @@
+/** @file control_channel.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief Runtime stream configuration and the command protocol used to change it over the TCP connection.
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details The client may send ASCII command lines terminated by '\\n' on the telemetry connection.
+ * Every command is answered with a single line: <b>#ok</b> followed by the resulting configuration,
+ * or <b>#err</b> followed by the reason the command was rejected. Lines starting with '#' are
+ * never measurement rows. Changes take effect from the next period of the running tasks,
+ * nothing is restarted.
+ * 
+ * - <b>get</b> - report the current configuration and the measured load of each core
+ * - <b>set loop</b> <i>ms</i> - period of the control loop and of measurement sampling
+ * - <b>set rate</b> <i>sensor ms</i> - sampling period of a timer driven sensor of #SENSOR_REGISTRY
+ * - <b>set format</b> <i>csv|bin</i> - encoding of telemetry records, see telemetry.h
+ * - <b>set decimation</b> <i>n</i> - transmit every n-th sample only
+ * - <b>set batch</b> <i>n</i> - number of records gathered into a single send()
+ * - <b>burst</b> [<i>param value</i>] - report or change the burst windows and triggers, see burst.h
+ * - <b>txbench</b> <i>s</i> - saturate the link for s seconds, handled by the tcp server, see tcp_server.h
+ * 
+ * Limits are static ranges and the measured CPU load: a change increasing a rate by a factor of
+ * k is rejected if k times the load of the busiest core would exceed #CPU_LOAD_LIMIT_PERCENT.
+ * Increases are rejected while no complete load window has been measured, see cpu_load.h.
+ */
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/** @def LOOP_PERIOD_MS
+ * @brief Default execution period of control loop [ms]. 
+ */
+#define LOOP_PERIOD_MS 50
+/** @def MEASUREMENTS_WCET
+ * @brief Worst Case Execution Time of the measurement gathering task.
+ */
+#define MEASUREMENTS_WCET 10
+/** @def OUTPUT_CALC_WCET
+ * @brief Worst Case Execution Time of output calculation task.
+ */
+#define OUTPUT_CALC_WCET 40
+/** @def LOOP_PERIOD_MIN_MS
+ * @brief Shortest control loop period, both tasks of the loop have to fit in a period [ms].
+ */
+#define LOOP_PERIOD_MIN_MS (MEASUREMENTS_WCET > OUTPUT_CALC_WCET ? MEASUREMENTS_WCET : OUTPUT_CALC_WCET)
+/** @def LOOP_PERIOD_MAX_MS
+ * @brief Longest control loop period [ms].
+ */
+#define LOOP_PERIOD_MAX_MS 1000
+/** @def MAX_DECIMATION
+ * @brief Largest accepted decimation factor.
+ */
+#define MAX_DECIMATION 100
+/** @def MAX_BATCH
+ * @brief Largest number of records sent together.
+ */
+#define MAX_BATCH 16
+/** @def CPU_LOAD_LIMIT_PERCENT
+ * @brief Projected load of the busiest core a rate increase may lead to [%].
+ */
+#define CPU_LOAD_LIMIT_PERCENT 80
+/** @def CONTROL_POLL_MS
+ * @brief Longest time between two checks for incoming commands [ms].
+ */
+#define CONTROL_POLL_MS 100
+/** @def CONTROL_REPLY_SIZE
+ * @brief A reply to a command including the terminating null character needs to fit in.
+ */
+#define CONTROL_REPLY_SIZE 160
+
+/**
+ * @brief Encoding of transmitted measurement records.
+ */
+typedef enum output_format{
+    OUTPUT_FORMAT_CSV, /**< #telemetry_to_csv() rows */
+    OUTPUT_FORMAT_BIN, /**< #telemetry_to_bin() frames */
+} output_format;
+
+/**
+ * @brief Settings which can be changed while the tasks are running.
+ */
+typedef struct stream_config{
+    uint32_t loop_period_ms;
+    output_format format;
+    uint32_t decimation;
+    uint32_t batch_size;
+} stream_config;
+
+/**
+ * @brief Get a consistent copy of the current stream configuration.
+ * 
+ * @param config - pointer to stream_config instance which will be updated
+ */
+void stream_config_get(stream_config *config);
+
+/**
+ * @brief Execute a single command line and format its reply.
+ * 
+ * @param line - null terminated command, modified while parsing
+ * @param reply - destination of the reply line of at least #CONTROL_REPLY_SIZE bytes
+ * @return length of the reply including the terminating '\\n'
+ */
+size_t control_handle_command(char *line, char *reply);
+
+#endif //__CONTROL_CHANNEL_H__
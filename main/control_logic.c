@@ -0,0 +1,22 @@
+#include "control_logic.h"
+#include <stddef.h>
+
+void control_reset(control_state *state)
+{
+    state->out_duty = THROTTLE_STATIONARY_DUTY;
+}
+
+float control_step(control_state *state, const measurements_data *data)
+{
+    //no measurements received, out_duty set to stationary
+    if(data == NULL)
+    {
+        state->out_duty = THROTTLE_STATIONARY_DUTY;
+    }
+    //output computation
+    else
+    {
+        state->out_duty = data->throttle_in_duty;
+    }
+    return state->out_duty;
+}
@@ -0,0 +1,45 @@
+/** @file control_logic.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Throttle output computed from the measurements of a control period.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details output_compute_task() applies the output of the previous period at the beginning of
+ * every period, then computes the next one with #control_step() from the measurements it receives,
+ * or from none if they did not arrive within half a period. The computation keeps its state in a
+ * #control_state and has no esp-idf dependencies, so the same code is run against the plant model
+ * of pc_side/vehicle_sim.c on the host.
+ *
+ * The current logic passes the throttle input of the rc receiver through, and stops the motor
+ * when the measurements time out.
+ */
+#ifndef CONTROL_LOGIC_H
+#define CONTROL_LOGIC_H
+
+#include "sensors.h"
+
+/**
+ * @brief State kept by the control logic between periods.
+ */
+typedef struct control_state{
+    //duty cycle applied at the beginning of the next period [%]
+    float out_duty;
+} control_state;
+
+/**
+ * @brief Initialise the state, the motor is stopped until the first measurements arrive.
+ */
+void control_reset(control_state *state);
+
+/**
+ * @brief Compute the throttle output of the next period.
+ *
+ * @param state - state of the control logic
+ * @param data - measurements of the current period, NULL if they timed out
+ * @return duty cycle to apply with #set_throttle_duty() [%]
+ */
+float control_step(control_state *state, const measurements_data *data);
+
+#endif //__CONTROL_LOGIC_H__
@@ -0,0 +1,93 @@
+#include "cpu_load.h"
+#include <assert.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+
+static const char *TAG = "cpu_load";
+
+static uint32_t window_ticks[portNUM_PROCESSORS];
+static uint32_t idle_ticks[portNUM_PROCESSORS];
+static volatile uint32_t load_percent[portNUM_PROCESSORS];
+//set once the core has completed its first window
+static volatile bool window_complete[portNUM_PROCESSORS];
+
+static inline void IRAM_ATTR cpu_load_tick(int cpu)
+{
+    if(xTaskGetCurrentTaskHandleForCPU(cpu) == xTaskGetIdleTaskHandleForCPU(cpu))
+    {
+        idle_ticks[cpu]++;
+    }
+    if(++window_ticks[cpu] == CPU_LOAD_WINDOW_TICKS)
+    {
+        load_percent[cpu] = 100 - idle_ticks[cpu] * 100 / CPU_LOAD_WINDOW_TICKS;
+        window_complete[cpu] = true;
+        window_ticks[cpu] = 0;
+        idle_ticks[cpu] = 0;
+    }
+}
+
+static void IRAM_ATTR cpu0_tick_hook(void)
+{
+    cpu_load_tick(0);
+}
+
+#if portNUM_PROCESSORS > 1
+static void IRAM_ATTR cpu1_tick_hook(void)
+{
+    cpu_load_tick(1);
+}
+#endif
+
+esp_err_t cpu_load_init(void)
+{
+    esp_err_t err = esp_register_freertos_tick_hook_for_cpu(cpu0_tick_hook, 0);
+#if portNUM_PROCESSORS > 1
+    if(err == ESP_OK)
+    {
+        err = esp_register_freertos_tick_hook_for_cpu(cpu1_tick_hook, 1);
+    }
+#endif
+    if(err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Registered tick hooks");
+    }
+    else //ESP_ERR_NO_MEM or ESP_ERR_INVALID_ARG
+    {
+        ESP_LOGE(TAG, "Unsuccessfull tick hook registration");
+    }
+    return err;
+}
+
+uint32_t cpu_load_percent(int cpu)
+{
+    assert(cpu >= 0 && cpu < portNUM_PROCESSORS);
+    return load_percent[cpu];
+}
+
+bool cpu_load_valid(void)
+{
+    for(int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+    {
+        if(!window_complete[cpu])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t cpu_load_max_percent(void)
+{
+    uint32_t max = 0;
+    for(int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+    {
+        if(load_percent[cpu] > max)
+        {
+            max = load_percent[cpu];
+        }
+    }
+    return max;
+}
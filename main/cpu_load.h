@@ -0,0 +1,54 @@
+/** @file cpu_load.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief Per core CPU load estimation with FreeRTOS tick hooks.
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details A tick hook is registered on every core. On each tick the hook checks whether the
+ * idle task of its core is running, and the share of non-idle ticks over a window of
+ * #CPU_LOAD_WINDOW_TICKS is published as the load of that core. The estimate is statistical,
+ * its resolution is one tick, but it costs a few instructions per tick and needs no run time
+ * statistics support from FreeRTOS.
+ */
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/** @def CPU_LOAD_WINDOW_TICKS
+ * @brief number of ticks a load estimate is averaged over
+ */
+#define CPU_LOAD_WINDOW_TICKS configTICK_RATE_HZ
+
+/**
+ * @brief Register the load measuring tick hook on every core.
+ * 
+ * @return ESP_OK on success, error of esp_register_freertos_tick_hook_for_cpu() otherwise
+ */
+esp_err_t cpu_load_init(void);
+
+/**
+ * @brief Get load of a core measured over the last complete window.
+ * 
+ * @param cpu - core number
+ * @return share of ticks not spent in the idle task [%]
+ */
+uint32_t cpu_load_percent(int cpu);
+
+/**
+ * @brief Check whether every core has completed a window, the loads read 0 until then.
+ * 
+ * @details Stays false if cpu_load_init() failed.
+ */
+bool cpu_load_valid(void);
+
+/**
+ * @brief Get load of the busiest core measured over the last complete window [%].
+ */
+uint32_t cpu_load_max_percent(void);
+
+#endif //__CPU_LOAD_H__
@@ -0,0 +1,166 @@
+#include "deferred_log.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+static const char *TAG = "deferred_log";
+
+typedef struct dlog_slot{
+    //sequence number of the slot, tells producers and the consumer whose turn it is
+    atomic_uint_fast32_t seq;
+    uint16_t id;
+    uint32_t time_ms;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_slot;
+
+typedef struct dlog_ring{
+    atomic_uint_fast32_t head;
+    uint32_t tail;
+    atomic_uint_fast32_t dropped;
+    dlog_slot slots[DLOG_RING_LEN];
+} dlog_ring;
+
+_Static_assert((DLOG_RING_LEN & (DLOG_RING_LEN - 1)) == 0, "DLOG_RING_LEN must be a power of two");
+
+static dlog_ring rings[portNUM_PROCESSORS];
+
+#define DLOG_MIN_INTERVAL(id, level, tag, argument_count, min_interval_ms, format) min_interval_ms,
+static const uint32_t min_interval_ms[DLOG_MESSAGE_COUNT] = {DLOG_MESSAGES(DLOG_MIN_INTERVAL)};
+#define DLOG_LEVEL(id, level, tag, argument_count, min_interval_ms, format) level,
+static const esp_log_level_t levels[DLOG_MESSAGE_COUNT] = {DLOG_MESSAGES(DLOG_LEVEL)};
+#define DLOG_TAG(id, level, tag, argument_count, min_interval_ms, format) tag,
+static const char *const tags[DLOG_MESSAGE_COUNT] = {DLOG_MESSAGES(DLOG_TAG)};
+//rate limiting state, only accessed by the drain task
+static uint32_t last_emit_ms[DLOG_MESSAGE_COUNT];
+static uint32_t suppressed[DLOG_MESSAGE_COUNT];
+
+void IRAM_ATTR dlog_write(dlog_id id, const uint32_t *args)
+{
+    dlog_ring *ring = &rings[xPortGetCoreID()];
+    uint_fast32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    dlog_slot *slot;
+    //claim a free slot, a slot is free for position pos when its sequence equals pos
+    while(true)
+    {
+        slot = &ring->slots[pos & (DLOG_RING_LEN - 1)];
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if(diff == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+    slot->id = id;
+    slot->time_ms = esp_timer_get_time() / 1000;
+    memcpy(slot->args, args, sizeof(slot->args));
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+static void report_suppressed(uint16_t id)
+{
+    if(suppressed[id] > 0)
+    {
+        ESP_LOG_LEVEL(levels[id], tags[id], "%"PRIu32" similar messages suppressed", suppressed[id]);
+        suppressed[id] = 0;
+    }
+}
+
+static void emit(const dlog_slot *slot)
+{
+    if(slot->time_ms - last_emit_ms[slot->id] < min_interval_ms[slot->id] && last_emit_ms[slot->id] != 0)
+    {
+        suppressed[slot->id]++;
+        return;
+    }
+    last_emit_ms[slot->id] = slot->time_ms;
+#define DLOG_ARGS_0(args)
+#define DLOG_ARGS_1(args) , args[0]
+#define DLOG_ARGS_2(args) , args[0], args[1]
+#define DLOG_ARGS_3(args) , args[0], args[1], args[2]
+#define DLOG_EMIT(id, level, tag, argument_count, min_interval_ms, format)                    \
+    case id:                                                                                  \
+        ESP_LOG_LEVEL(level, tag, "[%"PRIu32" ms] " format,                                   \
+                      slot->time_ms DLOG_ARGS_##argument_count(slot->args));                  \
+        break;
+    switch(slot->id)
+    {
+        DLOG_MESSAGES(DLOG_EMIT)
+        default:
+            break;
+    }
+    report_suppressed(slot->id);
+}
+
+//counts of bursts which stopped within the limit would wait for the next message of the same id
+static void flush_suppressed(void)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    for(uint16_t id = 0; id < DLOG_MESSAGE_COUNT; id++)
+    {
+        if(suppressed[id] > 0 && now_ms - last_emit_ms[id] >= min_interval_ms[id])
+        {
+            //the report counts as an emitted message, a burst still going on stays limited
+            last_emit_ms[id] = now_ms;
+            report_suppressed(id);
+        }
+    }
+}
+
+void dlog_task(void *pvParameters)
+{
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    while(true)
+    {
+        for(int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+        {
+            dlog_ring *ring = &rings[cpu];
+            while(true)
+            {
+                dlog_slot *slot = &ring->slots[ring->tail & (DLOG_RING_LEN - 1)];
+                if(atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->tail + 1)
+                {
+                    break;
+                }
+                dlog_slot copy = {.id = slot->id, .time_ms = slot->time_ms};
+                memcpy(copy.args, slot->args, sizeof(copy.args));
+                //hand the slot back to producers for the next lap of the ring
+                atomic_store_explicit(&slot->seq, ring->tail + DLOG_RING_LEN, memory_order_release);
+                ring->tail++;
+                emit(&copy);
+            }
+            uint32_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+            if(dropped > 0)
+            {
+                ESP_LOGW(TAG, "%"PRIu32" messages dropped on core %d", dropped, cpu);
+            }
+        }
+        flush_suppressed();
+        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(DLOG_DRAIN_PERIOD_MS));
+    }
+}
+
+void dlog_init(void)
+{
+    for(int cpu = 0; cpu < portNUM_PROCESSORS; cpu++)
+    {
+        for(uint32_t i = 0; i < DLOG_RING_LEN; i++)
+        {
+            atomic_init(&rings[cpu].slots[i].seq, i);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/** @file deferred_log.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief Deferred binary logging for the real-time paths.
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details ESP_LOG formats its message and blocks on the UART, which takes milliseconds at
+ * 115200 baud. #DLOG() instead writes the id of a message declared in #DLOG_MESSAGES, a timestamp
+ * and the raw arguments into a lock-free ring of the calling core, which takes microseconds
+ * and never blocks. A low priority task drains the rings every #DLOG_DRAIN_PERIOD_MS, formats the
+ * messages with ESP_LOG and applies the rate limit of each message: messages repeated within
+ * the limit are counted and the count is reported with the next emitted one, or by the drain
+ * task once the limit has passed without one. Messages not fitting
+ * into a full ring are counted as dropped and reported as well.
+ * 
+ * The rings are bounded multi producer queues, so #DLOG() is safe from any task or interrupt,
+ * whichever core it runs on.
+ */
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include <inttypes.h>
+#include "esp_log.h"
+
+/** @def DLOG_MESSAGES
+ * @brief X(id, level, tag, argument_count, min_interval_ms, format)
+ * 
+ * @details Arguments are passed as uint32_t, formats have to use matching conversions.
+ */
+#define DLOG_MESSAGES(X) \
+    X(DLOG_TCP_TRANSMIT,        ESP_LOG_INFO,  "tcp_server", 1, 1000, "transmitting %"PRIu32" bytes") \
+    X(DLOG_AGGREGATION_LEVEL,   ESP_LOG_ERROR, "main",       1, 1000, "measurements task: telemetry queue is filling up, aggregation level %"PRIu32) \
+    X(DLOG_MEASUREMENT_TIMEOUT, ESP_LOG_ERROR, "main",       0, 1000, "outputcompute task: timeout for measurements data receive") \
+    X(DLOG_FILTER_OVER_BUDGET,  ESP_LOG_WARN,  "main",       1, 1000, "measurements task: filter step took %"PRIu32" cycles")
+
+/** @def DLOG_MAX_ARGS
+ * @brief largest argument count of a message
+ */
+#define DLOG_MAX_ARGS 3
+/** @def DLOG_RING_LEN
+ * @brief messages a ring of a core can hold, power of two
+ */
+#define DLOG_RING_LEN 64
+/** @def DLOG_DRAIN_PERIOD_MS
+ * @brief period of the task formatting the messages [ms]
+ */
+#define DLOG_DRAIN_PERIOD_MS 100
+
+/**
+ * @brief Identify a message of #DLOG_MESSAGES.
+ */
+typedef enum dlog_id{
+#define DLOG_ID_ENUMERATOR(id, level, tag, argument_count, min_interval_ms, format) id,
+    DLOG_MESSAGES(DLOG_ID_ENUMERATOR)
+#undef DLOG_ID_ENUMERATOR
+    DLOG_MESSAGE_COUNT
+} dlog_id;
+
+/** @def DLOG
+ * @brief DLOG(id, ...) logs message <b>id</b> with up to #DLOG_MAX_ARGS uint32_t arguments
+ * without blocking.
+ * 
+ * @details The id is the first element of the initialiser, so messages without arguments need
+ * neither an empty initialiser nor an empty variadic argument list.
+ */
+#define DLOG(...)                                                    \
+    do {                                                             \
+        const uint32_t dlog_args[1 + DLOG_MAX_ARGS] = {__VA_ARGS__}; \
+        dlog_write((dlog_id)dlog_args[0], dlog_args + 1);            \
+    } while(0)
+
+/**
+ * @brief Prepare the rings, called before the first message is logged.
+ */
+void dlog_init(void);
+
+/**
+ * @brief Task formatting the deferred messages, created with the pipeline.
+ */
+void dlog_task(void *pvParameters);
+
+/**
+ * @brief Queue a message on the ring of the calling core, use #DLOG() instead.
+ * 
+ * @param id - message id
+ * @param args - #DLOG_MAX_ARGS raw arguments
+ */
+void dlog_write(dlog_id id, const uint32_t *args);
+
+#endif //__DEFERRED_LOG_H__
@@ -0,0 +1,173 @@
+#include "jitter_bench.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "tcp_server.h"
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+#include "driver/gptimer.h"
+#include "esp_check.h"
+
+static const char *TAG = "jitter_bench";
+#endif
+
+typedef struct jitter_stats{
+    int64_t last_us;
+    uint32_t period_ms;
+    uint32_t count;
+    int32_t min_us;
+    int32_t max_us;
+    int64_t sum_us;
+    int64_t sum_sq_us;
+} jitter_stats;
+
+static const char *loop_names[JITTER_LOOP_COUNT] = {
+#define JITTER_LOOP_NAME(name) #name,
+    JITTER_LOOPS(JITTER_LOOP_NAME)
+};
+
+static jitter_stats stats[JITTER_LOOP_COUNT];
+static portMUX_TYPE stats_spinlock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+//resolution of the load timer [Hz]
+#define LOAD_TIMER_RESOLUTION_HZ 1000000
+static QueueHandle_t load_queue = NULL;
+//the load is applied in every other report window, so each one is compared to the previous
+static bool load_active = false;
+static uint32_t load_generated = 0;
+static uint32_t load_dropped = 0;
+#endif
+
+static inline void jitter_stats_restart(jitter_stats *s)
+{
+    s->count = 0;
+    s->sum_us = 0;
+    s->sum_sq_us = 0;
+}
+
+void jitter_bench_record(jitter_loop loop, uint32_t period_ms)
+{
+    int64_t now_us = esp_timer_get_time();
+    jitter_stats *s = &stats[loop];
+    taskENTER_CRITICAL(&stats_spinlock);
+    if(s->last_us != 0 && s->period_ms == period_ms)
+    {
+        int32_t error_us = (int32_t)(now_us - s->last_us) - (int32_t)(period_ms * 1000);
+        if(s->count == 0 || error_us < s->min_us)
+        {
+            s->min_us = error_us;
+        }
+        if(s->count == 0 || error_us > s->max_us)
+        {
+            s->max_us = error_us;
+        }
+        s->sum_us += error_us;
+        s->sum_sq_us += (int64_t)error_us * error_us;
+        s->count++;
+    }
+    s->last_us = now_us;
+    s->period_ms = period_ms;
+    taskEXIT_CRITICAL(&stats_spinlock);
+}
+
+size_t jitter_bench_report(char *buffer)
+{
+    jitter_stats snapshot[JITTER_LOOP_COUNT];
+    taskENTER_CRITICAL(&stats_spinlock);
+    for(int i = 0; i < JITTER_LOOP_COUNT; i++)
+    {
+        snapshot[i] = stats[i];
+        jitter_stats_restart(&stats[i]);
+    }
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+    bool loaded = load_active;
+    uint32_t generated = load_generated;
+    uint32_t dropped = load_dropped;
+    load_active = !load_active;
+    load_generated = 0;
+    load_dropped = 0;
+#endif
+    taskEXIT_CRITICAL(&stats_spinlock);
+
+    int len = snprintf(buffer, JITTER_REPORT_SIZE, "#jitter");
+    for(int i = 0; i < JITTER_LOOP_COUNT && len < JITTER_REPORT_SIZE; i++)
+    {
+        const jitter_stats *s = &snapshot[i];
+        if(s->count == 0)
+        {
+            len += snprintf(buffer + len, JITTER_REPORT_SIZE - len, " %s n=0", loop_names[i]);
+            continue;
+        }
+        //variance of the integer samples without the cancellation of single precision sums
+        int64_t n = s->count;
+        float variance = (float)(n * s->sum_sq_us - s->sum_us * s->sum_us) / (float)(n * n);
+        len += snprintf(buffer + len, JITTER_REPORT_SIZE - len,
+                        " %s n=%"PRIu32" min=%"PRId32" max=%"PRId32" mean=%.1f std=%.1f",
+                        loop_names[i], s->count, s->min_us, s->max_us,
+                        (float)s->sum_us / n, sqrtf(variance));
+    }
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+    if(len < JITTER_REPORT_SIZE)
+    {
+        len += snprintf(buffer + len, JITTER_REPORT_SIZE - len,
+                        " load=%d generated=%"PRIu32" dropped=%"PRIu32,
+                        loaded ? CONFIG_RC_CAR_JITTER_BENCHMARK_RATE_HZ : 0, generated, dropped);
+    }
+#endif
+    if(len > JITTER_REPORT_SIZE - 2)
+    {
+        len = JITTER_REPORT_SIZE - 2;
+    }
+    buffer[len++] = '\n';
+    buffer[len] = '\0';
+    return len;
+}
+
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+//queue a load token every period of the timer while a client is connected
+static bool IRAM_ATTR load_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *event, void *arg)
+{
+    if(server_state != Connected || !load_active)
+    {
+        return false;
+    }
+    uint8_t token = 0;
+    BaseType_t task_woken = pdFALSE;
+    BaseType_t sent = xQueueSendFromISR(load_queue, &token, &task_woken);
+    taskENTER_CRITICAL_ISR(&stats_spinlock);
+    load_generated++;
+    if(sent != pdTRUE)
+    {
+        load_dropped++;
+    }
+    taskEXIT_CRITICAL_ISR(&stats_spinlock);
+    return task_woken == pdTRUE;
+}
+
+esp_err_t jitter_load_start(QueueHandle_t queue)
+{
+    load_queue = queue;
+    gptimer_handle_t timer = NULL;
+    const gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = LOAD_TIMER_RESOLUTION_HZ,
+    };
+    ESP_RETURN_ON_ERROR(gptimer_new_timer(&timer_config, &timer), TAG, "load timer");
+    const gptimer_event_callbacks_t callbacks = {
+        .on_alarm = load_alarm,
+    };
+    ESP_RETURN_ON_ERROR(gptimer_register_event_callbacks(timer, &callbacks, NULL), TAG, "load callback");
+    const gptimer_alarm_config_t alarm_config = {
+        .alarm_count = LOAD_TIMER_RESOLUTION_HZ / CONFIG_RC_CAR_JITTER_BENCHMARK_RATE_HZ,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_RETURN_ON_ERROR(gptimer_set_alarm_action(timer, &alarm_config), TAG, "load alarm");
+    ESP_RETURN_ON_ERROR(gptimer_enable(timer), TAG, "load timer enable");
+    return gptimer_start(timer);
+}
+#endif
@@ -0,0 +1,94 @@
+/** @file jitter_bench.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Control period jitter statistics and the telemetry load generator benchmarking them.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details Every loop of #JITTER_LOOPS timestamps its wake-ups with #jitter_bench_record(). The
+ * deviation of each measured period from the configured one is collected into min, max, mean
+ * and standard deviation, which the tcp server sends to the client as a <b>#jitter</b> line
+ * every #JITTER_REPORT_PERIOD_MS, then the statistics are restarted.
+ *
+ * With <b>RC_CAR_JITTER_BENCHMARK</b> set under <b>RC Car Pipeline Configuration</b> in project
+ * configuration menu, a hardware timer started by #jitter_load_start() on the networking core
+ * queues a load token at a steady <b>RC_CAR_JITTER_BENCHMARK_RATE_HZ</b>. For every token the
+ * tcp server encodes and transmits a copy of the first record of the connection on top of the
+ * regular stream. The load only passes through the encoding and transmission path: no sensor
+ * is read and the telemetry queue and its aggregation are left alone. The load is applied in
+ * every other report window, so the encoding and transmission load of a fast stream can be
+ * compared to the unloaded windows and between the core partitioning profiles by the jitter of
+ * the control loops.
+ */
+#ifndef JITTER_BENCH_H
+#define JITTER_BENCH_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+
+/** @def JITTER_LOOPS
+ * @brief X(name) of every periodic loop whose jitter is measured
+ */
+#define JITTER_LOOPS(X) \
+    X(measurements)     \
+    X(output_compute)
+
+/** @def JITTER_REPORT_PERIOD_MS
+ * @brief period of the jitter report sent to the client [ms]
+ */
+#define JITTER_REPORT_PERIOD_MS 10000
+/** @def JITTER_REPORT_SIZE
+ * @brief A jitter report including the terminating null character needs to fit in.
+ */
+#define JITTER_REPORT_SIZE 256
+
+/**
+ * @brief Identify a loop of #JITTER_LOOPS.
+ */
+typedef enum jitter_loop{
+#define JITTER_LOOP_ENUMERATOR(name) JITTER_LOOP_##name,
+    JITTER_LOOPS(JITTER_LOOP_ENUMERATOR)
+#undef JITTER_LOOP_ENUMERATOR
+    JITTER_LOOP_COUNT
+} jitter_loop;
+
+/**
+ * @brief Record a wake-up of a loop, called at the beginning of every period.
+ *
+ * @details The first wake-up after a change of the period only restarts the measurement.
+ *
+ * @param loop - loop woken up
+ * @param period_ms - period the loop is running with [ms]
+ */
+void jitter_bench_record(jitter_loop loop, uint32_t period_ms);
+
+/**
+ * @brief Format a <b>#jitter</b> line with the number of periods, min, max, mean and standard
+ * deviation of the period error of every loop in us, and restart the statistics.
+ *
+ * @details With the benchmark enabled the line ends with the load rate of the window, 0 in
+ * the unloaded windows, and the number of generated load tokens and of those dropped because
+ * the tcp server fell behind. The load is switched on or off for the next window.
+ *
+ * @param buffer - destination of at least #JITTER_REPORT_SIZE bytes
+ * @return length of the line
+ */
+size_t jitter_bench_report(char *buffer);
+
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+/**
+ * @brief Start the load timer, its interrupt is allocated on the calling core.
+ *
+ * @details Tokens are only queued while a client is connected and in the loaded windows.
+ *
+ * @param queue - queue of single byte tokens, drained by the tcp server
+ * @return ESP_OK on success, the error of the timer driver otherwise
+ */
+esp_err_t jitter_load_start(QueueHandle_t queue);
+#endif
+
+#endif //__JITTER_BENCH_H__
@@ -0,0 +1,164 @@
+#include "pipeline.h"
+#include "tcp_server.h"
+#include "deferred_log.h"
+#include "tcp_transport.h"
+#include "burst.h"
+#include <stdio.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "pipeline";
+
+#if CONFIG_FREERTOS_UNICORE && CONFIG_RC_CAR_CORES_PARTITIONED
+#error "core partitioning requires both cores, disable FREERTOS_UNICORE"
+#endif
+#if CONFIG_RC_CAR_CORES_PARTITIONED
+//the sensor timer callbacks are dispatched by the esp_timer task, or by its interrupt
+#if !CONFIG_ESP_TIMER_TASK_AFFINITY_CPU1
+#warning "esp_timer callbacks of the sensors run outside the real-time core, set ESP_TIMER_TASK_AFFINITY to CPU1"
+#endif
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD && !CONFIG_ESP_TIMER_ISR_AFFINITY_CPU1
+#warning "esp_timer interrupt is allocated outside the real-time core, set ESP_TIMER_ISR_AFFINITY to CPU1"
+#endif
+#if !CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0
+#warning "lwIP TCP/IP task is not pinned to the networking core, set LWIP_TCPIP_TASK_AFFINITY to CPU0"
+#endif
+#if CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1
+#warning "Wi-Fi task is pinned to the real-time core, set ESP_WIFI_TASK_CORE_ID to core 0"
+#endif
+#endif
+
+static pipeline_handles pipeline;
+
+#define PIPELINE_CHECK_STACK(name, function, stack_bytes, priority, core) \
+    _Static_assert((stack_bytes) >= configMINIMAL_STACK_SIZE && (stack_bytes) <= PIPELINE_STACK_MAX, \
+                   "stack of " #name " out of range");
+PIPELINE_TASKS(PIPELINE_CHECK_STACK)
+_Static_assert(PIPELINE_MEMORY_TOTAL <= PIPELINE_MEMORY_BUDGET,
+               "pipeline does not fit PIPELINE_MEMORY_BUDGET, reduce the queue lengths, batches or ring lengths");
+
+#if CONFIG_RC_CAR_CORES_PARTITIONED
+#define PIPELINE_CORES "partitioned"
+#else
+#define PIPELINE_CORES "shared"
+#endif
+
+#if CONFIG_RC_CAR_STATIC_ALLOCATION
+#define PIPELINE_ALLOCATION "static"
+#define PIPELINE_TASK_STORAGE(name, function, stack_bytes, priority, core) \
+    static StackType_t name##_stack[stack_bytes];                          \
+    static StaticTask_t name##_tcb;
+PIPELINE_TASKS(PIPELINE_TASK_STORAGE)
+#define PIPELINE_QUEUE_STORAGE(name, length, item_size) \
+    static uint8_t name##_storage[(length) * (item_size)]; \
+    static StaticQueue_t name##_control;
+PIPELINE_QUEUES(PIPELINE_QUEUE_STORAGE)
+#else
+#define PIPELINE_ALLOCATION "heap"
+#endif
+
+esp_err_t pipeline_create(void)
+{
+#if CONFIG_RC_CAR_STATIC_ALLOCATION
+#define PIPELINE_CREATE_QUEUE(name, length, item_size) \
+    pipeline.queues.name = xQueueCreateStatic(length, item_size, name##_storage, &name##_control);
+#define PIPELINE_CREATE_TASK(name, function, stack_bytes, priority, core)                   \
+    pipeline.tasks.name = xTaskCreateStaticPinnedToCore(function, #name, stack_bytes,         \
+                                                        (void *)&pipeline, priority,          \
+                                                        name##_stack, &name##_tcb, core);
+#else
+#define PIPELINE_CREATE_QUEUE(name, length, item_size) \
+    pipeline.queues.name = xQueueCreate(length, item_size);
+#define PIPELINE_CREATE_TASK(name, function, stack_bytes, priority, core)                   \
+    xTaskCreatePinnedToCore(function, #name, stack_bytes, (void *)&pipeline, priority,       \
+                            &pipeline.tasks.name, core);
+#endif
+#define PIPELINE_CHECK(name, ...)                                 \
+    if(pipeline.name == NULL)                                     \
+    {                                                             \
+        ESP_LOGE(TAG, "%s could not be created", #name);         \
+        return ESP_ERR_NO_MEM;                                    \
+    }
+#define PIPELINE_CHECK_QUEUE(name, ...) PIPELINE_CHECK(queues.name)
+#define PIPELINE_CHECK_TASK(name, ...) PIPELINE_CHECK(tasks.name)
+    PIPELINE_QUEUES(PIPELINE_CREATE_QUEUE)
+    PIPELINE_QUEUES(PIPELINE_CHECK_QUEUE)
+    PIPELINE_TASKS(PIPELINE_CREATE_TASK)
+    PIPELINE_TASKS(PIPELINE_CHECK_TASK)
+    return ESP_OK;
+}
+
+typedef struct core_call{
+    void (*function)(void);
+    TaskHandle_t caller;
+} core_call;
+
+static void core_call_task(void *pvParameters)
+{
+    core_call *call = (core_call *)pvParameters;
+    call->function();
+    xTaskNotifyGive(call->caller);
+    vTaskDelete(NULL);
+}
+
+esp_err_t pipeline_call_on_core(void (*function)(void), BaseType_t core)
+{
+    core_call call = {
+        .function = function,
+        .caller = xTaskGetCurrentTaskHandle(),
+    };
+    //priority of the caller, the call is finished before the caller continues
+    if(xTaskCreatePinnedToCore(core_call_task, "core_call", 4096, (void *)&call,
+                               uxTaskPriorityGet(NULL), NULL, core) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return ESP_OK;
+}
+
+void pipeline_log_memory_map(void)
+{
+    ESP_LOGI(TAG, "%s allocation, %s cores", PIPELINE_ALLOCATION, PIPELINE_CORES);
+#define PIPELINE_LOG_TASK(name, function, stack_bytes, priority, core)                 \
+    ESP_LOGI(TAG, "task  %-16s %6u bytes", #name, (unsigned)PIPELINE_TASK_BYTES(stack_bytes));
+#define PIPELINE_LOG_QUEUE(name, length, item_size)                                     \
+    ESP_LOGI(TAG, "queue %-16s %6u bytes", #name, (unsigned)PIPELINE_QUEUE_BYTES(length, item_size));
+    PIPELINE_TASKS(PIPELINE_LOG_TASK)
+    PIPELINE_QUEUES(PIPELINE_LOG_QUEUE)
+    ESP_LOGI(TAG, "buff  %-16s %6u bytes", "telemetry_tx", (unsigned)PIPELINE_TX_BYTES);
+#if CONFIG_RC_CAR_BURST_CAPTURE
+    ESP_LOGI(TAG, "buff  %-16s %6u bytes", "burst_rings", (unsigned)PIPELINE_BURST_BYTES);
+#endif
+    ESP_LOGI(TAG, "total %-16s %6u bytes of %u, free heap %u bytes", "", (unsigned)PIPELINE_MEMORY_TOTAL,
+             (unsigned)PIPELINE_MEMORY_BUDGET, (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+}
+
+size_t pipeline_memory_report(char *buffer)
+{
+    int len = snprintf(buffer, PIPELINE_REPORT_SIZE, "#mem heap=%u min_heap=%u largest=%u",
+                       (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                       (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                       (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#define PIPELINE_REPORT_STACK(name, function, stack_bytes, priority, core)                       \
+    {                                                                                           \
+        unsigned free_bytes = uxTaskGetStackHighWaterMark(pipeline.tasks.name);                 \
+        if(free_bytes < PIPELINE_STACK_MARGIN / 2)                                              \
+        {                                                                                       \
+            ESP_LOGW(TAG, "%s has %u of %u stack bytes left, raise its stack",                  \
+                     #name, free_bytes, (unsigned)(stack_bytes));                               \
+        }                                                                                       \
+        if(len < PIPELINE_REPORT_SIZE)                                                          \
+        {                                                                                       \
+            len += snprintf(buffer + len, PIPELINE_REPORT_SIZE - len, " %s=%u", #name, free_bytes); \
+        }                                                                                       \
+    }
+    PIPELINE_TASKS(PIPELINE_REPORT_STACK)
+    if(len > PIPELINE_REPORT_SIZE - 2)
+    {
+        len = PIPELINE_REPORT_SIZE - 2;
+    }
+    buffer[len++] = '\n';
+    buffer[len] = '\0';
+    return len;
+}
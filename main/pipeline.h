@@ -0,0 +1,262 @@
+/** @file pipeline.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief Single configuration of the tasks, queues and buffers of the measurement pipeline.
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details Tasks are declared in #PIPELINE_TASKS, queues in #PIPELINE_QUEUES, and their sizes are
+ * derived from the configured rates and depths. #pipeline_create() allocates every object from the
+ * heap, or with <b>RC_CAR_STATIC_ALLOCATION</b> set under <b>RC Car Pipeline Configuration</b>
+ * in project configuration menu, from statically allocated storage, which leaves the heap to
+ * Wi-Fi and lwIP and rules out fragmentation on long runs.
+ * 
+ * Task stacks are derived from the sizes of the largest locals of each task, and never go below
+ * the stacks the tasks ran with before they were derived. The derived sizes are estimates, they
+ * are validated against the stack high water marks at runtime: #pipeline_memory_report() sends
+ * them to the client and logs a warning for every task that used up most of its margin.
+ *
+ * The size of every object is known at build time, their sum is checked against
+ * #PIPELINE_MEMORY_BUDGET and every stack against #PIPELINE_STACK_MAX by static assertions.
+ * The build writes the map of every object and its size into <b>build/pipeline_map.txt</b>,
+ * evaluated by the target compiler from pipeline_map.c, and #pipeline_log_memory_map() logs
+ * the same map at boot together with the free heap.
+ * 
+ * Tasks are placed on the cores by the partitioning profile chosen under <b>RC Car Pipeline
+ * Configuration</b>. The shared profile keeps the original placement, sampling shares core 0
+ * with Wi-Fi and lwIP. The partitioned profile dedicates #PIPELINE_NET_CORE to networking,
+ * encoding and transmission and #PIPELINE_RT_CORE to sampling, the sensor interrupts, the
+ * esp_timer callbacks and control. pipeline.c checks at build time that the esp_timer, lwIP and
+ * Wi-Fi tasks are configured onto the matching cores.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "sensors.h"
+#include "telemetry.h"
+#include "control_channel.h"
+#include "clock_sync.h"
+#include "jitter_bench.h"
+#include "deferred_log.h"
+#include "sensor_filter.h"
+#include "control_logic.h"
+#include "boot_time.h"
+#include "tcp_server.h"
+#include "tcp_transport.h"
+#include "burst.h"
+
+/** @def MEASUREMENTS_QUEUE_LEN
+ * @brief measurements passed from measurements_task to output_compute_task
+ */
+#define MEASUREMENTS_QUEUE_LEN 1
+/** @def TELEMETRY_QUEUE_LEN
+ * @brief Records waiting for transmission. Holds two of the largest batches and the records
+ * produced at the fastest loop rate while the tcp server polls commands and waits for a pong.
+ */
+#define TELEMETRY_QUEUE_LEN (2 * MAX_BATCH + \
+                             (CONTROL_POLL_MS + CLOCK_SYNC_TIMEOUT_MS + LOOP_PERIOD_MIN_MS - 1) / LOOP_PERIOD_MIN_MS)
+/** @def JITTER_LOAD_QUEUE_LEN
+ * @brief Load tokens of the jitter benchmark waiting for the tcp server. Holds two of the
+ * largest batches and the tokens queued while the tcp server polls commands and waits for a pong.
+ */
+#define JITTER_LOAD_QUEUE_LEN (2 * MAX_BATCH + CONFIG_RC_CAR_JITTER_BENCHMARK_RATE_HZ * \
+                               (CONTROL_POLL_MS + CLOCK_SYNC_TIMEOUT_MS) / 1000)
+/** @def TELEMETRY_TX_BUFF_SIZE
+ * @brief a batch of the largest encoded records needs to fit in a slot of the transmit ring
+ */
+#define TELEMETRY_RECORD_MAX_LEN (TELEMETRY_CSV_MAX_LEN > TELEMETRY_BIN_MAX_LEN ? \
+                                  TELEMETRY_CSV_MAX_LEN : TELEMETRY_BIN_MAX_LEN)
+#define TELEMETRY_TX_BUFF_SIZE (MAX_BATCH * TELEMETRY_RECORD_MAX_LEN)
+/** @def PIPELINE_MEM_REPORT_PERIOD_MS
+ * @brief period of the memory report sent to the client [ms]
+ */
+#define PIPELINE_MEM_REPORT_PERIOD_MS 10000
+/** @def PIPELINE_REPORT_SIZE
+ * @brief A memory report including the terminating null character needs to fit in.
+ */
+#define PIPELINE_REPORT_SIZE 160
+
+/** @def PIPELINE_MEMORY_BUDGET
+ * @brief upper bound of the memory taken by the pipeline objects, checked at build time [bytes]
+ */
+#define PIPELINE_MEMORY_BUDGET (96 * 1024)
+/** @def PIPELINE_STACK_MAX
+ * @brief largest stack a task may derive, checked at build time [bytes]
+ */
+#define PIPELINE_STACK_MAX 8192
+
+/** @def PIPELINE_NET_CORE
+ * @brief core of Wi-Fi, lwIP and the tasks feeding them
+ */
+#define PIPELINE_NET_CORE 0
+/** @def PIPELINE_RT_CORE
+ * @brief core of the sensor interrupts and the output control
+ */
+#define PIPELINE_RT_CORE 1
+#if CONFIG_RC_CAR_CORES_PARTITIONED
+#define PIPELINE_NET_AFFINITY PIPELINE_NET_CORE
+#define PIPELINE_SAMPLING_CORE PIPELINE_RT_CORE
+#else
+#define PIPELINE_NET_AFFINITY tskNO_AFFINITY
+#define PIPELINE_SAMPLING_CORE 0
+#endif
+
+/** @def PIPELINE_STACK_FLOOR
+ * @brief smallest stack of a task, the stack the control tasks ran with before the stacks were
+ * derived [bytes]
+ */
+#define PIPELINE_STACK_FLOOR 2048
+/** @def TCP_SERVER_STACK_FLOOR
+ * @brief stack the tcp server ran with before the stacks were derived [bytes]
+ */
+#define TCP_SERVER_STACK_FLOOR 4096
+/** @def PIPELINE_STACK_AT_LEAST
+ * @brief the derived stack, or the floor if it is larger
+ */
+#define PIPELINE_STACK_AT_LEAST(derived, floor) ((derived) > (floor) ? (derived) : (floor))
+
+/** @def PIPELINE_STACK_BASE
+ * @brief stack every task needs besides its own frame: the saved context, nested interrupt
+ * frames and the calls into FreeRTOS and the drivers [bytes]
+ */
+#define PIPELINE_STACK_BASE 1024
+/** @def PIPELINE_STACK_LOG
+ * @brief stack of ESP_LOG and snprintf, added for the tasks formatting text [bytes]
+ */
+#define PIPELINE_STACK_LOG 1024
+/** @def PIPELINE_STACK_MARGIN
+ * @brief margin on top of every derived stack, the high water marks in the <b>#mem</b> report
+ * show how much of it is left [bytes]
+ */
+#define PIPELINE_STACK_MARGIN 512
+
+/* Stack of every task derived from the sizes of its largest locals, so changing a record,
+ * the aggregation or a report size grows the stacks along with them. The output task logs
+ * the errors of the ledc driver. */
+#define MEASUREMENTS_STACK_BYTES PIPELINE_STACK_AT_LEAST(                                          \
+    PIPELINE_STACK_BASE + PIPELINE_STACK_MARGIN + sizeof(measurements_data) +                     \
+    sizeof(telemetry_record) + sizeof(aggregator) + sizeof(sensor_filter) + sizeof(stream_config), \
+    PIPELINE_STACK_FLOOR)
+#define OUTPUT_COMPUTE_STACK_BYTES PIPELINE_STACK_AT_LEAST(                                        \
+    PIPELINE_STACK_BASE + PIPELINE_STACK_LOG + PIPELINE_STACK_MARGIN + sizeof(measurements_data) + \
+    sizeof(control_state) + sizeof(stream_config),                                                \
+    PIPELINE_STACK_FLOOR)
+/* NVS and Wi-Fi are brought up by the tcp server before it transmits, on a stack at least as
+ * large as the main task stack app_main() brought them up on. Report buffers are scoped
+ * separately, they are summed in case the compiler does not overlay them. */
+#define TCP_SERVER_STACK_BYTES PIPELINE_STACK_AT_LEAST(                                            \
+    PIPELINE_STACK_BASE + PIPELINE_STACK_LOG + PIPELINE_STACK_MARGIN + TCP_SERVER_ADDR_SIZE +      \
+    2 * sizeof(telemetry_record) + sizeof(stream_config) + CONTROL_REPLY_SIZE +                   \
+    CLOCK_SYNC_MSG_SIZE + BOOT_TIME_REPORT_SIZE + PIPELINE_REPORT_SIZE + JITTER_REPORT_SIZE +      \
+    TX_STAT_SIZE,                                                                                 \
+    PIPELINE_STACK_AT_LEAST(CONFIG_ESP_MAIN_TASK_STACK_SIZE, TCP_SERVER_STACK_FLOOR))
+#define DLOG_STACK_BYTES PIPELINE_STACK_AT_LEAST(                                                  \
+    PIPELINE_STACK_BASE + PIPELINE_STACK_LOG + PIPELINE_STACK_MARGIN +                            \
+    (DLOG_MAX_ARGS + 3) * sizeof(uint32_t),                                                       \
+    PIPELINE_STACK_FLOOR)
+
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+#define PIPELINE_BENCHMARK_QUEUES(X) \
+    X(jitter_load_queue,  JITTER_LOAD_QUEUE_LEN,  sizeof(uint8_t))
+#else
+#define PIPELINE_BENCHMARK_QUEUES(X)
+#endif
+
+/** @def PIPELINE_TASKS
+ * @brief X(name, function, stack_bytes, priority, core)
+ *
+ * @details Tasks are created in this order, the control tasks first, the tcp server brings up
+ * the network after them.
+ */
+#define PIPELINE_TASKS(X) \
+    X(measurements,   measurements_task,   MEASUREMENTS_STACK_BYTES,   2,                    PIPELINE_SAMPLING_CORE) \
+    X(output_compute, output_compute_task, OUTPUT_COMPUTE_STACK_BYTES, 2,                    PIPELINE_RT_CORE)       \
+    X(tcp_server,     tcp_server_task,     TCP_SERVER_STACK_BYTES,     1,                    PIPELINE_NET_AFFINITY)  \
+    X(deferred_log,   dlog_task,           DLOG_STACK_BYTES,           tskIDLE_PRIORITY + 1, PIPELINE_NET_AFFINITY)
+
+/** @def PIPELINE_QUEUES
+ * @brief X(name, length, item_size)
+ */
+#define PIPELINE_QUEUES(X) \
+    X(measurements_queue, MEASUREMENTS_QUEUE_LEN, sizeof(measurements_data)) \
+    X(telemetry_queue,    TELEMETRY_QUEUE_LEN,    sizeof(telemetry_record)) \
+    PIPELINE_BENCHMARK_QUEUES(X)
+
+/* Footprint of every pipeline object, summed into PIPELINE_MEMORY_TOTAL, written into the
+ * build-time map by pipeline_map.c and logged by pipeline_log_memory_map(). */
+#define PIPELINE_TASK_BYTES(stack_bytes) ((stack_bytes) + sizeof(StaticTask_t))
+#define PIPELINE_QUEUE_BYTES(length, item_size) ((length) * (item_size) + sizeof(StaticQueue_t))
+#define PIPELINE_TX_BYTES (TRANSPORT_TX_SLOTS * TELEMETRY_TX_BUFF_SIZE)
+#if CONFIG_RC_CAR_BURST_CAPTURE
+#define PIPELINE_BURST_BYTES (2 * BURST_RING_LEN * sizeof(burst_event))
+#else
+#define PIPELINE_BURST_BYTES 0
+#endif
+#define PIPELINE_TASK_TOTAL(name, function, stack_bytes, priority, core) + PIPELINE_TASK_BYTES(stack_bytes)
+#define PIPELINE_QUEUE_TOTAL(name, length, item_size) + PIPELINE_QUEUE_BYTES(length, item_size)
+#define PIPELINE_MEMORY_TOTAL (0 PIPELINE_TASKS(PIPELINE_TASK_TOTAL) PIPELINE_QUEUES(PIPELINE_QUEUE_TOTAL) + \
+                               PIPELINE_TX_BYTES + PIPELINE_BURST_BYTES)
+
+/**
+ * @brief Handles of the pipeline objects, every task receives a pointer to it as parameter.
+ */
+typedef struct pipeline_handles{
+#define PIPELINE_TASK_HANDLE(name, function, stack_bytes, priority, core) TaskHandle_t name;
+    struct { PIPELINE_TASKS(PIPELINE_TASK_HANDLE) } tasks;
+#undef PIPELINE_TASK_HANDLE
+#define PIPELINE_QUEUE_HANDLE(name, length, item_size) QueueHandle_t name;
+    struct { PIPELINE_QUEUES(PIPELINE_QUEUE_HANDLE) } queues;
+#undef PIPELINE_QUEUE_HANDLE
+} pipeline_handles;
+
+/**
+ * @brief Read sensors every control period, pass measurements to output_compute_task and telemetry records to the tcp server.
+ */
+void measurements_task(void *pvParameters);
+
+/**
+ * @brief Compute the throttle output from the measurements every control period.
+ */
+void output_compute_task(void *pvParameters);
+
+/**
+ * @brief Create every queue, then every task of the pipeline.
+ * 
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if an object could not be allocated
+ */
+esp_err_t pipeline_create(void);
+
+/**
+ * @brief Run <b>function</b> in a temporary task pinned to <b>core</b> and wait for it to return.
+ * 
+ * @details Interrupts are allocated on the core installing the driver, sensors_init() is run
+ * this way on #PIPELINE_RT_CORE by the partitioned profile.
+ * 
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t pipeline_call_on_core(void (*function)(void), BaseType_t core);
+
+/**
+ * @brief Log the size of every pipeline object and their sum.
+ */
+void pipeline_log_memory_map(void);
+
+/**
+ * @brief Format a <b>#mem</b> line with the current and minimum free heap, the largest free
+ * block and the stack high water mark of every task, all in bytes.
+ * 
+ * @details A warning is logged for every task with less than half of #PIPELINE_STACK_MARGIN
+ * left, the derived stack of that task underestimates its use.
+ * 
+ * @param buffer - destination of at least #PIPELINE_REPORT_SIZE bytes
+ * @return length of the line
+ */
+size_t pipeline_memory_report(char *buffer);
+
+#endif //__PIPELINE_H__
@@ -0,0 +1,23 @@
+#include "pipeline.h"
+
+/* Not linked into the firmware. The build compiles this file into assembly only, where every
+ * entry is an "@map kind name bytes" string with the size evaluated by the target compiler,
+ * and pipeline_map.cmake collects them into build/pipeline_map.txt, see main/CMakeLists.txt. */
+#define PIPELINE_MAP_ENTRY(kind, name, bytes) \
+    __asm__ volatile("\n.ascii \"@map " kind " " name " %c0\"" : : "n"((unsigned)(bytes)));
+
+void pipeline_map(void)
+{
+#define PIPELINE_MAP_TASK(name, function, stack_bytes, priority, core) \
+    PIPELINE_MAP_ENTRY("task ", #name, PIPELINE_TASK_BYTES(stack_bytes))
+#define PIPELINE_MAP_QUEUE(name, length, item_size) \
+    PIPELINE_MAP_ENTRY("queue", #name, PIPELINE_QUEUE_BYTES(length, item_size))
+    PIPELINE_TASKS(PIPELINE_MAP_TASK)
+    PIPELINE_QUEUES(PIPELINE_MAP_QUEUE)
+    PIPELINE_MAP_ENTRY("buff ", "telemetry_tx", PIPELINE_TX_BYTES)
+#if CONFIG_RC_CAR_BURST_CAPTURE
+    PIPELINE_MAP_ENTRY("buff ", "burst_rings", PIPELINE_BURST_BYTES)
+#endif
+    PIPELINE_MAP_ENTRY("total", "all", PIPELINE_MEMORY_TOTAL)
+    PIPELINE_MAP_ENTRY("budget", "all", PIPELINE_MEMORY_BUDGET)
+}
@@ -0,0 +1,9 @@
+# Collect the "@map kind name bytes" entries of the assembly of pipeline_map.c into a text file.
+# usage: cmake -D IN=<assembly> -D OUT=<map> -P pipeline_map.cmake
+file(STRINGS "${IN}" entries REGEX "@map ")
+set(map "")
+foreach(entry IN LISTS entries)
+    string(REGEX REPLACE "^.*@map ([^\"]*)\".*$" "\\1" entry "${entry}")
+    string(APPEND map "${entry}\n")
+endforeach()
+file(WRITE "${OUT}" "${map}")
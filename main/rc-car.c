@@ -1,6 +1,15 @@
-#include "wifi_station.h"
 #include "tcp_server.h"
+#include "pipeline.h"
 #include "sensors.h"
+#include "telemetry.h"
+#include "control_channel.h"
+#include "control_logic.h"
+#include "cpu_load.h"
+#include "deferred_log.h"
+#include "jitter_bench.h"
+#include "burst.h"
+#include "sensor_filter.h"
+#include "boot_time.h"
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -8,124 +17,117 @@
 #include "esp_system.h"
 #include "esp_event.h"
 #include "esp_log.h"
-
-/** @def CYCLE_PERIOD_MS
- * @brief Execution period of control loop. 
- */
-#define LOOP_PERIOD_MS 50
-/** @def MEASUREMENT_WCET
- * @brief Worst Case Execution Time of the measurement gathering task.
- */
-#define MEASUREMENTS_WCET 10
-/** @def OUTPUT_CALC_WCET
- * @brief Worst Case Execution Time of output calculation task.
- */
-#define OUTPUT_CALC_WCET 40
-#define MEASUREMENTS_QUEUE_LEN 1
-//queue length for csv measurement rows
-#define MEASUREMENTS_CSV_QUEUE_LEN 5
+#include "esp_cpu.h"
 
 static const char *TAG = "main";
 
 void measurements_task(void *pvParameters)
 {
-    QueueHandle_t xMeasurementsQueue = ((QueueHandle_t *)pvParameters)[0];
-    QueueHandle_t xMeasurementsCSVQueue = ((QueueHandle_t *)pvParameters)[1];
+    const pipeline_handles *pipeline = (const pipeline_handles *)pvParameters;
+    QueueHandle_t xMeasurementsQueue = pipeline->queues.measurements_queue;
+    QueueHandle_t xTelemetryQueue = pipeline->queues.telemetry_queue;
     measurements_data data;
-    char tx_buff[CSV_BUFF_SIZE];
+    telemetry_record record;
+    aggregator agg;
+    stream_config config;
+    uint32_t decimation_count = 0;
+    sensor_filter filter;
+    sensor_filter_reset(&filter);
+    aggregator_reset(&agg);
     TickType_t xLastWakeTime = xTaskGetTickCount();
     while(true)
     {
+        stream_config_get(&config);
+        jitter_bench_record(JITTER_LOOP_measurements, config.loop_period_ms);
         get_measurements(&data);
+        burst_check(&data);
+        //outlier gate and estimates of the filter stage, within a bounded cycle budget
+        uint32_t filter_start = esp_cpu_get_cycle_count();
+        sensor_filter_step(&filter, &data);
+        uint32_t filter_cycles = esp_cpu_get_cycle_count() - filter_start;
+        if(filter_cycles > SENSOR_FILTER_BUDGET_CYCLES)
+        {
+            DLOG(DLOG_FILTER_OVER_BUDGET, filter_cycles);
+        }
         //send measurements to output_compute_task
         xQueueSend(xMeasurementsQueue, (void*)(&data), portMAX_DELAY);
-        //client connected to TCP server, measurements are sent to server 
-        if(server_state == Connected)
+        //client connected to TCP server, every decimation-th measurement is sent to server,
+        //aggregated into windows while the link falls behind
+        if(server_state == Connected && ++decimation_count >= config.decimation)
         {
-            if(uxQueueSpacesAvailable(xMeasurementsCSVQueue) > 1)
+            decimation_count = 0;
+            UBaseType_t spaces = uxQueueSpacesAvailable(xTelemetryQueue);
+            uint8_t level = agg.level;
+            if(aggregator_push(&agg, &data, spaces, TELEMETRY_QUEUE_LEN, &record))
             {
-                measurements_to_csv(tx_buff, &data);
-                xQueueSend(xMeasurementsCSVQueue, (void*)(tx_buff), pdMS_TO_TICKS(0));
+                aggregator_queued(&agg, xQueueSend(xTelemetryQueue, (void*)(&record), pdMS_TO_TICKS(0)) == pdTRUE);
             }
-            //only one free space is left in the queue, client is warned about data loss
-            else if(uxQueueSpacesAvailable(xMeasurementsCSVQueue) == 1)
+            if(agg.level > level)
             {
-                xQueueSend(xMeasurementsCSVQueue,
-                           "Some data may be untransmitted\n",
-                           pdMS_TO_TICKS(0));
-                ESP_LOGE(TAG, "measurements task: measurements csv queue is full");
+                DLOG(DLOG_AGGREGATION_LEVEL, agg.level);
             }
         }
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(LOOP_PERIOD_MS));
+        else if(server_state != Connected)
+        {
+            aggregator_reset(&agg);
+        }
+        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(config.loop_period_ms));
     }
 }
 
 void output_compute_task(void *pvParameters)
 {
-    QueueHandle_t xMeasurementsQueue = (QueueHandle_t)pvParameters;
+    QueueHandle_t xMeasurementsQueue = ((const pipeline_handles *)pvParameters)->queues.measurements_queue;
     measurements_data data;
-    float out_duty = THROTTLE_STATIONARY_DUTY;
+    stream_config config;
+    control_state control;
+    control_reset(&control);
+    float out_duty = control.out_duty;
     TickType_t xLastWakeTime = xTaskGetTickCount();
+    //the throttle is passed through from the first period on
+    boot_time_mark(BOOT_PHASE_control);
     while(true)
     {
+        stream_config_get(&config);
+        jitter_bench_record(JITTER_LOOP_output_compute, config.loop_period_ms);
         //ensure fixed period updates by updating control output at the beginning of the period
         set_throttle_duty(out_duty);
-        BaseType_t received_ok = xQueueReceive(xMeasurementsQueue, (void*)(&data), pdMS_TO_TICKS(LOOP_PERIOD_MS/2));
-        //no measurements received, out_duty set to stationary
+        BaseType_t received_ok = xQueueReceive(xMeasurementsQueue, (void*)(&data), pdMS_TO_TICKS(config.loop_period_ms/2));
         if(!received_ok)
         {
-            ESP_LOGE(TAG, "outputcompute task: timeout for measurements data receive");
-            out_duty = THROTTLE_STATIONARY_DUTY;
+            DLOG(DLOG_MEASUREMENT_TIMEOUT);
         }
-        //output computation
-        else
-        {
-            out_duty = data.throttle_in_duty;
-        }
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(LOOP_PERIOD_MS));
+        out_duty = control_step(&control, received_ok ? &data : NULL);
+        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(config.loop_period_ms));
     }
 }
 
 void app_main(void)
 {
+    boot_time_mark(BOOT_PHASE_app_main);
     ESP_ERROR_CHECK(esp_event_loop_create_default());
+    //real-time tasks log through the deferred log
+    dlog_init();
+#if CONFIG_RC_CAR_CORES_PARTITIONED
+    //sensor interrupts are allocated on the core installing the drivers
+    ESP_ERROR_CHECK(pipeline_call_on_core(sensors_init, PIPELINE_RT_CORE));
+#else
     sensors_init();
-    nvs_init();
-    wifi_init_sta();
-    /* FreeRTOS queue handle used by measurements_task() to 
-    pass measurements_data instances to output_compute_task()*/
-    QueueHandle_t xMeasurementsQueue = xQueueCreate(MEASUREMENTS_QUEUE_LEN, sizeof(measurements_data));
-    if(xMeasurementsQueue == NULL)
+#endif
+    boot_time_mark(BOOT_PHASE_sensors);
+    //measured core load limits the rates selectable over the control channel, it is sampled
+    //from before the tasks start, rate increases are rejected until a window is complete
+    if(cpu_load_init() != ESP_OK)
     {
-        ESP_LOGE(TAG, "xMeasurementsQueue could not be created");
-        return;
+        ESP_LOGE(TAG, "cpu load is not measured, rate increases are rejected");
     }
-    /* FreeRTOS queue handle used by measurements_task() to
-    pass measurements in csv format to the tcp server*/
-    QueueHandle_t xMeasurementsCSVQueue = xQueueCreate(MEASUREMENTS_CSV_QUEUE_LEN, CSV_BUFF_SIZE);
-    if(xMeasurementsCSVQueue == NULL)
+    /* queues and tasks of the pipeline, handles are passed to every task in
+    a statically allocated struct, which outlives app_main(). NVS and Wi-Fi are
+    brought up by tcp_server_task in the background, see boot_time.h*/
+    if(pipeline_create() != ESP_OK)
     {
-        ESP_LOGE(TAG, "xMeasurementsCSVQueue could not be created");
+        ESP_LOGE(TAG, "pipeline could not be created");
         return;
     }
-    xTaskCreate(tcp_server_task, "tcp_server", 4096, (void *)xMeasurementsCSVQueue, 1, NULL);
-    QueueHandle_t pvParameters[] = {xMeasurementsQueue, xMeasurementsCSVQueue}; 
-    xTaskCreatePinnedToCore(measurements_task, "measurements", 2048, (void *)pvParameters, 2, NULL, 0);
-    xTaskCreatePinnedToCore(output_compute_task, "output_compute", 2048, (void *)xMeasurementsQueue, 2, NULL, 1);
-    if(esp_register_freertos_tick_hook_for_cpu(, 0) == ESP_OK)
-    {
-        ESP_LOGE(TAG, "Registered tick hook on cpu 0");
-    }
-    else //ESP_ERR_NO_MEM or ESP_ERR_INVALID_ARG
-    {
-        ESP_LOGE(TAG, "Unsuccessfull tick hook regitration on cpu 0");
-    }
-    if(esp_register_freertos_tick_hook_for_cpu(, 1) == ESP_OK)
-    {
-        ESP_LOGE(TAG, "Registered tick hook on cpu 1");
-    }
-    else //ESP_ERR_NO_MEM or ESP_ERR_INVALID_ARG
-    {
-        ESP_LOGE(TAG, "Unsuccessfull tick hook regitration on cpu 1");
-    }
-}
\ No newline at end of file
+    pipeline_log_memory_map();
+}
@@ -0,0 +1,54 @@
+/** @file sensor_conversions.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Conversions of raw sensor values to physical units.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details sensors.c converts the raw values of #SENSOR_REGISTRY with these functions, and
+ * pc_side/vehicle_sim.c converts the values of its sensor models with the same ones, so the
+ * simulation can not drift from the firmware. The header has no esp-idf dependencies, the
+ * frequency of the capture timer clock is passed in.
+ */
+#ifndef SENSOR_CONVERSIONS_H
+#define SENSOR_CONVERSIONS_H
+
+#include <inttypes.h>
+#include "sensors.h"
+
+/**
+ * @brief Rotational velocity from the tachometer counts of a reading interval [rot/min].
+ *
+ * @details Partial revolutions count, short reading periods are not quantised to whole ones.
+ */
+static inline float tacho_counts_to_rpm(tacho_raw raw)
+{
+    if(raw.interval_us == 0)
+    {
+        return 0;
+    }
+    return raw.counts * (6E7f / TACHO_COUNTS_PER_REVOLUTION) / raw.interval_us;
+}
+
+/**
+ * @brief Duty cycle from the high time of a #PWM_FREQ signal in capture timer ticks [%].
+ *
+ * @param clk_hz - frequency of the capture timer clock, the APB clock
+ */
+static inline float capture_ticks_to_duty(uint32_t ticks, uint32_t clk_hz)
+{
+    return ticks * 100.0*PWM_FREQ / clk_hz;
+}
+
+/**
+ * @brief Distance from the time of flight of the HC-SR04 echo in capture timer ticks [m].
+ *
+ * @param clk_hz - frequency of the capture timer clock, the APB clock
+ */
+static inline float echo_ticks_to_m(uint32_t ticks, uint32_t clk_hz)
+{
+    return ticks * (343.0/2 / clk_hz);
+}
+
+#endif //__SENSOR_CONVERSIONS_H__
@@ -0,0 +1,227 @@
+#include "sensor_filter.h"
+#include <string.h>
+#include <math.h>
+
+//scales the median absolute deviation to the standard deviation of a normal distribution
+#define MAD_TO_SIGMA 1.4826f
+
+_Static_assert(SENSOR_FILTER_WINDOW % 2 == 1, "SENSOR_FILTER_WINDOW must be odd");
+
+void sensor_filter_reset(sensor_filter *filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+//residuals confirming a jump, the majority of the window
+#define JUMP_CONFIRM ((SENSOR_FILTER_WINDOW + 1) / 2)
+
+//median of count values, count is odd, sorts them in place
+static float median(float *values, int count)
+{
+    for(int i = 1; i < count; i++)
+    {
+        float value = values[i];
+        int j = i;
+        for(; j > 0 && values[j - 1] > value; j--)
+        {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+    return values[count / 2];
+}
+
+/* add the residual of a new distance to the window, return false if it is an outlier,
+ * sigma is the standard deviation of the residual predicted by the Kalman filter */
+static bool gate_accepts(sensor_filter *filter, float residual, float sigma)
+{
+    filter->window[filter->window_head] = residual;
+    filter->window_head = (filter->window_head + 1) % SENSOR_FILTER_WINDOW;
+    float center = 0;
+    float limit = SENSOR_FILTER_HAMPEL_K * sigma;
+    //until the window fills up the residual is checked against the predicted deviation
+    if(filter->window_fill < SENSOR_FILTER_WINDOW)
+    {
+        filter->window_fill++;
+    }
+    else
+    {
+        float sorted[SENSOR_FILTER_WINDOW];
+        memcpy(sorted, filter->window, sizeof(sorted));
+        center = median(sorted, SENSOR_FILTER_WINDOW);
+        for(int i = 0; i < SENSOR_FILTER_WINDOW; i++)
+        {
+            sorted[i] = fabsf(sorted[i] - center);
+        }
+        limit = SENSOR_FILTER_HAMPEL_K * MAD_TO_SIGMA * median(sorted, SENSOR_FILTER_WINDOW);
+    }
+    if(limit < SENSOR_FILTER_MIN_DEVIATION_M)
+    {
+        limit = SENSOR_FILTER_MIN_DEVIATION_M;
+    }
+    return fabsf(residual - center) <= limit;
+}
+
+/* true if the last JUMP_CONFIRM residuals agree on a new distance, spikes scattered by
+ * multipath loosen the gate but do not agree with each other */
+static bool jump_confirmed(const sensor_filter *filter)
+{
+    float recent[JUMP_CONFIRM];
+    for(int i = 0; i < JUMP_CONFIRM; i++)
+    {
+        recent[i] = filter->window[(filter->window_head + SENSOR_FILTER_WINDOW - 1 - i) % SENSOR_FILTER_WINDOW];
+    }
+    float center = median(recent, JUMP_CONFIRM);
+    for(int i = 0; i < JUMP_CONFIRM; i++)
+    {
+        if(fabsf(recent[i] - center) > SENSOR_FILTER_MIN_DEVIATION_M)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* compare the rate of a new distance to the tachometer speed, return true while the median
+ * difference of the window shows a standing obstacle approached forward */
+static bool assumption_holds(sensor_filter *filter, const measurements_data *data, float speed)
+{
+    float dt = (data->time_us - filter->last_distance_us) * 1e-6f;
+    if(filter->last_distance_us != 0 && dt > 0)
+    {
+        float rate = (filter->last_distance - data->distance) / dt;
+        filter->mismatch[filter->mismatch_head] = rate - speed;
+        filter->mismatch_head = (filter->mismatch_head + 1) % SENSOR_FILTER_WINDOW;
+        if(filter->mismatch_fill < SENSOR_FILTER_WINDOW)
+        {
+            filter->mismatch_fill++;
+        }
+    }
+    filter->last_distance = data->distance;
+    filter->last_distance_us = data->time_us;
+    if(filter->mismatch_fill < SENSOR_FILTER_WINDOW)
+    {
+        return false;
+    }
+    float sorted[SENSOR_FILTER_WINDOW];
+    memcpy(sorted, filter->mismatch, sizeof(sorted));
+    return fabsf(median(sorted, SENSOR_FILTER_WINDOW)) <= SENSOR_FILTER_SPEED_MISMATCH;
+}
+
+//constant speed model, the distance shrinks by the closing speed
+static void predict(sensor_filter *filter, float dt)
+{
+    const float q = SENSOR_FILTER_ACCEL_NOISE * SENSOR_FILTER_ACCEL_NOISE;
+    float (*p)[2] = filter->p;
+    filter->x[0] -= filter->x[1] * dt;
+    float p00 = p[0][0] - 2 * dt * p[0][1] + dt * dt * p[1][1] + q * dt * dt * dt * dt / 4;
+    float p01 = p[0][1] - dt * p[1][1] - q * dt * dt * dt / 2;
+    p[0][0] = p00;
+    p[0][1] = p01;
+    p[1][0] = p01;
+    p[1][1] += q * dt * dt;
+}
+
+//scalar update of state component i with measurement z of variance r
+static void update(sensor_filter *filter, int i, float z, float r)
+{
+    float (*p)[2] = filter->p;
+    float s = p[i][i] + r;
+    float k0 = p[0][i] / s;
+    float k1 = p[1][i] / s;
+    float innovation = z - filter->x[i];
+    filter->x[0] += k0 * innovation;
+    filter->x[1] += k1 * innovation;
+    float p0i = p[0][i];
+    float p1i = p[1][i];
+    p[0][0] -= k0 * p0i;
+    p[0][1] -= k0 * p1i;
+    p[1][1] -= k1 * p1i;
+    p[1][0] = p[0][1];
+}
+
+void sensor_filter_step(sensor_filter *filter, measurements_data *data)
+{
+    const float r_distance = SENSOR_FILTER_DISTANCE_NOISE_M * SENSOR_FILTER_DISTANCE_NOISE_M;
+    const float r_speed = SENSOR_FILTER_SPEED_NOISE * SENSOR_FILTER_SPEED_NOISE;
+    float speed = data->rot_velocity * (float)(TACHO_M_PER_REVOLUTION / 60);
+    //a reading is fused once, whatever the sampling period is, a distance of 0 means no echo yet
+    bool new_distance = data->distance > 0 &&
+                        data->samples[SENSOR_ID_hc_sr04] != filter->last_distance_sample;
+    bool new_speed = data->samples[SENSOR_ID_tachometer] != filter->last_speed_sample;
+    //the flag holds between distances, the rates of outliers and jumps are outvoted by the median
+    if(new_distance)
+    {
+        filter->ttc_valid = assumption_holds(filter, data, speed);
+    }
+    filter->last_speed_sample = data->samples[SENSOR_ID_tachometer];
+    if(filter->initialised)
+    {
+        predict(filter, (data->time_us - filter->last_time_us) * 1e-6f);
+        filter->last_time_us = data->time_us;
+    }
+    bool accepted = false;
+    bool jumped = false;
+    float residual = 0;
+    if(new_distance)
+    {
+        filter->last_distance_sample = data->samples[SENSOR_ID_hc_sr04];
+        //the first distance initialises the prediction, its residual is 0
+        residual = filter->initialised ? data->distance - filter->x[0] : 0;
+        float sigma = filter->initialised ? sqrtf(filter->p[0][0] + r_distance) : 0;
+        accepted = gate_accepts(filter, residual, sigma);
+        //a residual too large to be fused is a jump only if the recent ones agree, otherwise an outlier
+        if(accepted && fabsf(residual) > SENSOR_FILTER_HAMPEL_K * sigma + SENSOR_FILTER_MIN_DEVIATION_M)
+        {
+            jumped = jump_confirmed(filter);
+            accepted = jumped;
+        }
+        filter->outliers += !accepted;
+    }
+    if(!filter->initialised)
+    {
+        if(accepted)
+        {
+            filter->initialised = true;
+            filter->x[0] = data->distance;
+            filter->x[1] = speed;
+            filter->p[0][0] = r_distance;
+            filter->p[0][1] = 0;
+            filter->p[1][0] = 0;
+            filter->p[1][1] = r_speed;
+            filter->last_time_us = data->time_us;
+        }
+        data->distance_filtered = data->distance;
+        data->closing_speed = speed;
+        data->ttc = SENSOR_FILTER_TTC_MAX_S;
+        data->ttc_valid = 0;
+        return;
+    }
+    //a jump confirmed by the recent residuals is a new obstacle, the speed is not derived from it
+    if(jumped)
+    {
+        filter->x[0] = data->distance;
+        filter->p[0][0] = r_distance;
+        filter->p[0][1] = 0;
+        filter->p[1][0] = 0;
+        //residuals of the window are moved to the new estimate
+        for(int i = 0; i < SENSOR_FILTER_WINDOW; i++)
+        {
+            filter->window[i] -= residual;
+        }
+    }
+    else if(accepted)
+    {
+        update(filter, 0, data->distance, r_distance);
+    }
+    if(new_speed)
+    {
+        update(filter, 1, speed, r_speed);
+    }
+    float distance = filter->x[0] > 0 ? filter->x[0] : 0;
+    float closing_speed = filter->x[1];
+    data->distance_filtered = distance;
+    data->closing_speed = closing_speed;
+    data->ttc = closing_speed * SENSOR_FILTER_TTC_MAX_S > distance ? distance / closing_speed : SENSOR_FILTER_TTC_MAX_S;
+    data->ttc_valid = filter->ttc_valid;
+}
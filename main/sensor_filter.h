@@ -0,0 +1,127 @@
+/** @file sensor_filter.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Streaming filter stage estimating the distance, closing speed and time to collision.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details measurements_task() passes every sample through #sensor_filter_step() before it is
+ * sent to output_compute_task() and the telemetry stream, which fills the fields of
+ * #DERIVED_FIELDS. Every step takes constant time in single precision.
+ *
+ * - <b>Outlier gate</b>: the residual of a new HC-SR04 distance against the distance predicted
+ *   by the Kalman filter is compared to the median of the last #SENSOR_FILTER_WINDOW residuals
+ *   (Hampel filter). Residuals further from the median than #SENSOR_FILTER_HAMPEL_K scaled median
+ *   absolute deviations, and at least #SENSOR_FILTER_MIN_DEVIATION_M, are rejected. Residuals
+ *   instead of raw distances keep an approaching obstacle from widening the gate, and a real jump
+ *   of the distance passes once it holds the majority of the window. Until the window fills up,
+ *   residuals are checked against their deviation predicted by the Kalman filter. A residual
+ *   passing the gate but too large to be fused is a jump only if the last half of the window
+ *   agrees on it within #SENSOR_FILTER_MIN_DEVIATION_M, otherwise it is rejected, so scattered
+ *   multipath spikes loosening the gate are not taken for a new obstacle. A jump resets the
+ *   estimated distance instead of being fused, so it does not disturb the closing speed.
+ * - <b>Kalman filter</b>: the state is the distance and the closing speed, a constant speed model
+ *   driven by white acceleration noise. Accepted distances and the speed of the car from the
+ *   tachometer, converted with #TACHO_M_PER_REVOLUTION, are fused when they are updated. The
+ *   tachometer counts without direction and is averaged over its reading period, its noise
+ *   covers both.
+ * - <b>Assumption check</b>: the obstacle is assumed to stand and the car to drive forward, so
+ *   the tachometer speed is taken as the closing speed. Reversing or a moving obstacle breaks it,
+ *   the gap then changes at another rate than the tachometer tells and the gate rejects the
+ *   distances. The rate of every new distance, gated or not, is compared to the tachometer speed,
+ *   and ttc_valid of #DERIVED_FIELDS is cleared while the median difference of the last
+ *   #SENSOR_FILTER_WINDOW is over #SENSOR_FILTER_SPEED_MISMATCH or the window is not full yet.
+ *   The estimates of such samples are not to be trusted.
+ * - <b>Time to collision</b> is the distance over the closing speed, #SENSOR_FILTER_TTC_MAX_S
+ *   while the gap is not closing.
+ *
+ * The module has no esp-idf dependencies, pc_side/filter_replay.c replays recorded logs through
+ * it on the host.
+ */
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "sensors.h"
+
+/** @def SENSOR_FILTER_WINDOW
+ * @brief residuals the median of the outlier gate is taken of, odd
+ */
+#define SENSOR_FILTER_WINDOW 5
+/** @def SENSOR_FILTER_HAMPEL_K
+ * @brief rejection threshold in scaled median absolute deviations
+ */
+#define SENSOR_FILTER_HAMPEL_K 3.0f
+/** @def SENSOR_FILTER_MIN_DEVIATION_M
+ * @brief distances closer to the median are always accepted [m]
+ */
+#define SENSOR_FILTER_MIN_DEVIATION_M 0.05f
+/** @def SENSOR_FILTER_ACCEL_NOISE
+ * @brief standard deviation of the acceleration of the model [m/s^2]
+ */
+#define SENSOR_FILTER_ACCEL_NOISE 3.0f
+/** @def SENSOR_FILTER_DISTANCE_NOISE_M
+ * @brief standard deviation of accepted HC-SR04 distances [m]
+ */
+#define SENSOR_FILTER_DISTANCE_NOISE_M 0.01f
+/** @def SENSOR_FILTER_SPEED_NOISE
+ * @brief standard deviation of the tachometer speed, resolution and averaging included [m/s]
+ */
+#define SENSOR_FILTER_SPEED_NOISE 0.3f
+/** @def SENSOR_FILTER_SPEED_MISMATCH
+ * @brief median difference of the distance rate and the tachometer speed the time to collision
+ * is flagged invalid above [m/s]
+ */
+#define SENSOR_FILTER_SPEED_MISMATCH 0.6f
+/** @def SENSOR_FILTER_TTC_MAX_S
+ * @brief time to collision reported while the gap is not closing [s]
+ */
+#define SENSOR_FILTER_TTC_MAX_S 99.0f
+/** @def SENSOR_FILTER_BUDGET_CYCLES
+ * @brief CPU cycles a step may take, longer steps are logged by measurements_task()
+ */
+#define SENSOR_FILTER_BUDGET_CYCLES 4000
+
+/**
+ * @brief State of the filter stage.
+ */
+typedef struct sensor_filter{
+    //residuals of the outlier gate, a ring of the last SENSOR_FILTER_WINDOW
+    float window[SENSOR_FILTER_WINDOW];
+    uint8_t window_head;
+    uint8_t window_fill;
+    //sample counts of the last readings, a changed count is a new reading
+    uint8_t last_distance_sample;
+    uint8_t last_speed_sample;
+    uint64_t last_time_us;
+    //distance [m], closing speed [m/s] and their covariance
+    bool initialised;
+    float x[2];
+    float p[2][2];
+    //differences of the distance rate and the tachometer speed, a ring like window
+    float mismatch[SENSOR_FILTER_WINDOW];
+    uint8_t mismatch_head;
+    uint8_t mismatch_fill;
+    float last_distance;
+    uint64_t last_distance_us;
+    bool ttc_valid;
+    uint32_t outliers;
+} sensor_filter;
+
+/**
+ * @brief Restart the filter, the state is initialised by the next valid distance.
+ */
+void sensor_filter_reset(sensor_filter *filter);
+
+/**
+ * @brief Process a sample and fill its fields of #DERIVED_FIELDS.
+ *
+ * @param filter - filter state
+ * @param data - sample taken by #get_measurements(), samples have to come in time order, new
+ * readings are told apart by their count in measurements_data::samples
+ */
+void sensor_filter_step(sensor_filter *filter, measurements_data *data);
+
+#endif //__SENSOR_FILTER_H__
@@ -0,0 +1,96 @@
+/** @file sensor_registry.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Declarative table of the sensors sampled by the measurement pipeline.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details Every sensor is described by one row of #SENSOR_REGISTRY and one or more rows of
+ * #SENSOR_FIELDS. The measurement storage, the interrupt protected snapshot taken by
+ * #get_measurements(), the #measurements_data struct, the csv encoding and the csv header are
+ * all generated from these tables with X-macros, so the hot path is expanded at compile time
+ * into straight line code without any per-field dispatch.
+ *
+ * Adding a sensor requires:
+ * - a #SENSOR_REGISTRY row naming the sensor, the type of its raw value, its peripheral,
+ *   its sampling mode, its default sampling period and the period range accepted at runtime,
+ * - a #SENSOR_FIELDS row for every value derived from the raw value,
+ * - a <b>name_setup()</b> function in sensors.c which configures the peripheral and publishes
+ *   raw values with <b>name_publish_isr()</b>, and the conversion functions named in #SENSOR_FIELDS.
+ *
+ * Values estimated from several sensors are declared in #DERIVED_FIELDS, and are computed by
+ * the filter stage of sensor_filter.h instead of a conversion function.
+ */
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include <inttypes.h>
+
+/**
+ * @brief Peripheral a sensor is read with.
+ */
+typedef enum sensor_periph{
+    SENSOR_PERIPH_PCNT,      /**< pulse counter unit */
+    SENSOR_PERIPH_MCPWM_CAP, /**< channel of the shared MCPWM capture timer */
+} sensor_periph;
+
+/**
+ * @brief How a new raw value is produced.
+ */
+typedef enum sensor_sampling{
+    SENSOR_SAMPLE_PERIODIC,  /**< an esp_timer reads the peripheral every period */
+    SENSOR_SAMPLE_CAPTURE,   /**< the peripheral publishes on every captured edge */
+    SENSOR_SAMPLE_TRIGGERED, /**< an esp_timer triggers the sensor every period, the result is captured */
+} sensor_sampling;
+
+/**
+ * @brief Raw tachometer value: pulse counts cumulated during the last reading interval.
+ */
+typedef struct tacho_raw{
+    int counts;
+    uint32_t interval_us;
+} tacho_raw;
+
+/** @def SENSOR_REGISTRY
+ * @brief X(name, raw_type, peripheral, sampling, period_ms, min_period_ms, max_period_ms)
+ *
+ * @details The period arguments are ignored by #SENSOR_SAMPLE_CAPTURE sensors, their rate
+ * is set by the captured signal.
+ */
+#define SENSOR_REGISTRY(X) \
+    X(tachometer,  tacho_raw, SENSOR_PERIPH_PCNT,      SENSOR_SAMPLE_PERIODIC,  VELO_MEAS_PERIOD_MS,     10, VELO_MEAS_PERIOD_MAX_MS) \
+    X(throttle_in, uint32_t,  SENSOR_PERIPH_MCPWM_CAP, SENSOR_SAMPLE_CAPTURE,   0,                       0,  0)                       \
+    X(hc_sr04,     uint32_t,  SENSOR_PERIPH_MCPWM_CAP, SENSOR_SAMPLE_TRIGGERED, DISTANCE_MEAS_PERIOD_MS, 60, 1000)
+
+/** @def SENSOR_FIELDS
+ * @brief F(sensor, field, type, format, header, conversion)
+ *
+ * @details Fields are output in the order of this table. <b>conversion</b> maps the raw value of
+ * <b>sensor</b> to the unit stated in <b>header</b>.
+ */
+#define SENSOR_FIELDS(F) \
+    F(tachometer,  rot_velocity,     float, "%f", "rot/min",             tacho_counts_to_rpm) \
+    F(throttle_in, throttle_in_duty, float, "%f", "throttle in duty[%]", cap_ticks_to_duty)   \
+    F(hc_sr04,     distance,         float, "%f", "distance[m]",         tof_ticks_to_m)
+
+/** @def DERIVED_FIELDS
+ * @brief F(source, field, type, format, header, conversion), same layout as #SENSOR_FIELDS
+ *
+ * @details Values estimated from the fields of #SENSOR_FIELDS by sensor_filter.c, they are
+ * stored and transmitted after the sensor fields. <b>source</b> and <b>conversion</b> are unused.
+ * ttc_valid is 1 while the assumptions of the time to collision hold and 0 otherwise, see
+ * sensor_filter.h, the mean of an aggregated window is the share of valid samples.
+ */
+#define DERIVED_FIELDS(F) \
+    F(filter, distance_filtered, float, "%f", "filtered distance[m]", sensor_filter_step) \
+    F(filter, closing_speed,     float, "%f", "closing speed[m/s]",   sensor_filter_step) \
+    F(filter, ttc,               float, "%f", "ttc[s]",               sensor_filter_step) \
+    F(filter, ttc_valid,         float, "%f", "ttc valid",            sensor_filter_step)
+
+/** @def MEASUREMENT_FIELDS
+ * @brief F(sensor, field, type, format, header, conversion), every field of a sample
+ */
+#define MEASUREMENT_FIELDS(F) SENSOR_FIELDS(F) DERIVED_FIELDS(F)
+
+#endif // __SENSOR_REGISTRY_H__
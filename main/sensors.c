@@ -1,5 +1,8 @@
 #include "sensors.h"
+#include "sensor_conversions.h"
+#include "burst.h"
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <assert.h>
 #include "freertos/FreeRTOS.h"
@@ -11,29 +14,114 @@
 #include "esp_timer.h"
 #include "esp_private/esp_clk.h"
 
-volatile int tachometer_counts = 0;
-volatile uint32_t throttle_in_duty_ticks = 0;
-volatile uint32_t echo_tof_ticks = 0;
+/* Raw measurement value of every registered sensor, the number of values published and the
+ * spinlock protecting them. Interrupts publish with name_publish_isr(), tasks read with
+ * name_read(), or with name_read_sample() along with the number of the value. */
+#define SENSOR_STORAGE(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) \
+    static volatile raw_type name##_raw = {0};                           \
+    static volatile uint8_t name##_samples = 0;                          \
+    static portMUX_TYPE name##_spinlock = portMUX_INITIALIZER_UNLOCKED;  \
+    static inline void name##_publish_isr(raw_type value)                \
+    {                                                                    \
+        taskENTER_CRITICAL_ISR(&name##_spinlock);                        \
+        name##_raw = value;                                              \
+        name##_samples++;                                                \
+        taskEXIT_CRITICAL_ISR(&name##_spinlock);                         \
+    }                                                                    \
+    static inline raw_type name##_read_sample(uint8_t *samples)          \
+    {                                                                    \
+        taskENTER_CRITICAL(&name##_spinlock);                            \
+        raw_type value = name##_raw;                                     \
+        *samples = name##_samples;                                       \
+        taskEXIT_CRITICAL(&name##_spinlock);                             \
+        return value;                                                    \
+    }                                                                    \
+    static inline raw_type name##_read(void)                             \
+    {                                                                    \
+        uint8_t samples;                                                 \
+        return name##_read_sample(&samples);                             \
+    }
+SENSOR_REGISTRY(SENSOR_STORAGE)
 
-static portMUX_TYPE tachometer_spinlock = portMUX_INITIALIZER_UNLOCKED;
-static portMUX_TYPE throttle_in_spinlock = portMUX_INITIALIZER_UNLOCKED;
-static portMUX_TYPE echo_spinlock = portMUX_INITIALIZER_UNLOCKED; 
+//runtime adjustable sampling periods, indexed by sensor_id
+#define SENSOR_NAME(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) #name,
+static const char *const sensor_names[SENSOR_COUNT] = {SENSOR_REGISTRY(SENSOR_NAME)};
+#define SENSOR_PERIOD(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) period_ms,
+static volatile uint32_t sensor_period_ms[SENSOR_COUNT] = {SENSOR_REGISTRY(SENSOR_PERIOD)};
+#define SENSOR_MIN_PERIOD(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) min_period_ms,
+static const uint32_t sensor_min_period_ms[SENSOR_COUNT] = {SENSOR_REGISTRY(SENSOR_MIN_PERIOD)};
+#define SENSOR_MAX_PERIOD(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) max_period_ms,
+static const uint32_t sensor_max_period_ms[SENSOR_COUNT] = {SENSOR_REGISTRY(SENSOR_MAX_PERIOD)};
+//esp_timer driving each sensor, NULL for capture driven sensors
+static esp_timer_handle_t sensor_timers[SENSOR_COUNT];
+
+//raw value to unit conversions referenced by SENSOR_FIELDS, see sensor_conversions.h
+static inline float cap_ticks_to_duty(uint32_t ticks)
+{
+    return capture_ticks_to_duty(ticks, esp_clk_apb_freq());
+}
+static inline float tof_ticks_to_m(uint32_t ticks)
+{
+    return echo_ticks_to_m(ticks, esp_clk_apb_freq());
+}
 
 void tachometer_callback(void *arg)
 {
+    static int64_t last_read_us = 0;
     pcnt_unit_handle_t pcnt_handle = (pcnt_unit_handle_t)(arg);
-    taskENTER_CRITICAL_ISR(&tachometer_spinlock);
-    ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_handle, &tachometer_counts));
-    taskEXIT_CRITICAL_ISR(&tachometer_spinlock);
+    tacho_raw raw = {0};
+    //the interval is measured, so the reading stays correct while the period is being changed
+    int64_t now_us = esp_timer_get_time();
+    ESP_ERROR_CHECK(pcnt_unit_get_count(pcnt_handle, &raw.counts));
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_handle));
+    raw.interval_us = last_read_us ? now_us - last_read_us : 0;
+    last_read_us = now_us;
+    tachometer_publish_isr(raw);
+}
+
+#if CONFIG_RC_CAR_BURST_CAPTURE
+bool tachometer_edge_callback(mcpwm_cap_channel_handle_t cap_chan,
+                              const mcpwm_capture_event_data_t *edata,
+                              void *user_ctx)
+{
+    BURST_RECORD_ISR(tachometer, BURST_EDGE_RISING, edata->cap_value);
+    return false;
 }
 
-void tachometer_setup(void)
+//timestamp tachometer edges for burst capture, the GPIO matrix routes the input to both peripherals
+static void tachometer_edges_setup(mcpwm_cap_timer_handle_t cap_timer)
 {
+    mcpwm_capture_channel_config_t channel_config = {
+        .gpio_num = TACHOMETER_GPIO,
+        .prescale = 1,
+        .flags.pos_edge = true,
+        .flags.neg_edge = false,
+        .flags.pull_up = false,
+        .flags.pull_down = false,
+        .flags.invert_cap_signal = false,
+        .flags.io_loop_back = false,
+    };
+    mcpwm_capture_event_callbacks_t event_callbacks = {
+        .on_cap = tachometer_edge_callback,
+    };
+    mcpwm_cap_channel_handle_t channel_handle = NULL;
+    ESP_ERROR_CHECK(mcpwm_new_capture_channel(cap_timer,
+                                              &channel_config,
+                                              &channel_handle));
+    ESP_ERROR_CHECK(mcpwm_capture_channel_register_event_callbacks(channel_handle,
+                                                                   &event_callbacks,
+                                                                   NULL));
+    ESP_ERROR_CHECK(mcpwm_capture_channel_enable(channel_handle));
+}
+#endif
+
+esp_timer_handle_t tachometer_setup(mcpwm_cap_timer_handle_t cap_timer, uint32_t period_ms)
+{
+    //the counter must not overflow with the longest period selectable at runtime
     pcnt_unit_config_t unit_config = {
         .high_limit = ROT_VEL_MAX *
                       TACHO_COUNTS_PER_REVOLUTION *
-                      VELO_MEAS_PERIOD_MS/1E3,
+                      VELO_MEAS_PERIOD_MAX_MS/1E3,
         .low_limit = -1,
         .flags.accum_count = false,
     };
@@ -58,6 +146,9 @@ void tachometer_setup(void)
                                                  PCNT_CHANNEL_EDGE_ACTION_INCREASE));
     ESP_ERROR_CHECK(pcnt_unit_enable(unit_handle));
     ESP_ERROR_CHECK(pcnt_unit_start(unit_handle));
+#if CONFIG_RC_CAR_BURST_CAPTURE
+    tachometer_edges_setup(cap_timer);
+#endif
     const esp_timer_create_args_t periodic_timer_args = {
         .callback = tachometer_callback,
         .arg = unit_handle,
@@ -65,7 +156,8 @@ void tachometer_setup(void)
     };
     esp_timer_handle_t tacho_periodic_handle = NULL;
     ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &tacho_periodic_handle));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(tacho_periodic_handle, VELO_MEAS_PERIOD_MS * 1E3));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(tacho_periodic_handle, period_ms * 1E3));
+    return tacho_periodic_handle;
 }
 
 mcpwm_cap_timer_handle_t capture_timer_setup(int group_id)
@@ -87,17 +179,17 @@ bool throttle_in_callback(mcpwm_cap_channel_handle_t cap_chan,
     if(edata->cap_edge == MCPWM_CAP_EDGE_POS)
     {
         pwm_pos_edge_ticks = edata->cap_value;
+        BURST_RECORD_ISR(throttle_in, BURST_EDGE_RISING, edata->cap_value);
     }
     else // MCPWM_CAP_EDGE_NEG
     {
-        taskENTER_CRITICAL_ISR(&throttle_in_spinlock);
-        throttle_in_duty_ticks = edata->cap_value - pwm_pos_edge_ticks;
-        taskEXIT_CRITICAL_ISR(&throttle_in_spinlock);
+        throttle_in_publish_isr(edata->cap_value - pwm_pos_edge_ticks);
+        BURST_RECORD_ISR(throttle_in, BURST_EDGE_FALLING, edata->cap_value);
     }
     return true;
 }
 
-void throttle_in_setup(mcpwm_cap_timer_handle_t timer_handle)
+esp_timer_handle_t throttle_in_setup(mcpwm_cap_timer_handle_t timer_handle, uint32_t period_ms)
 {
     mcpwm_capture_channel_config_t channel_config = {
         .gpio_num = THROTTLE_IN_GPIO,
@@ -120,6 +212,7 @@ void throttle_in_setup(mcpwm_cap_timer_handle_t timer_handle)
                                                                    &event_callbacks,
                                                                    NULL));
     ESP_ERROR_CHECK(mcpwm_capture_channel_enable(channel_handle));
+    return NULL;
 }
 
 //ultrasonic distance sensor helper functions
@@ -132,12 +225,12 @@ bool hc_sr04_echo_callback(mcpwm_cap_channel_handle_t cap_chan,
     if (edata->cap_edge == MCPWM_CAP_EDGE_POS) 
     {
         cap_val_pos_edge = edata->cap_value;
+        BURST_RECORD_ISR(hc_sr04, BURST_EDGE_RISING, edata->cap_value);
     }
     else 
     {
-        taskENTER_CRITICAL_ISR(&echo_spinlock);
-        echo_tof_ticks = edata->cap_value - cap_val_pos_edge;
-        taskEXIT_CRITICAL_ISR(&echo_spinlock);
+        hc_sr04_publish_isr(edata->cap_value - cap_val_pos_edge);
+        BURST_RECORD_ISR(hc_sr04, BURST_EDGE_FALLING, edata->cap_value);
     }
     return true;
 }
@@ -149,7 +242,7 @@ void echo_trigger(void *arg)
     gpio_set_level(HC_SR04_TRIG_GPIO, 0); // set low
 }
 
-void distance_sensor_setup(mcpwm_cap_timer_handle_t timer_handle)
+esp_timer_handle_t hc_sr04_setup(mcpwm_cap_timer_handle_t timer_handle, uint32_t period_ms)
 {
     mcpwm_capture_channel_config_t channel_config = {
         .gpio_num = HC_SR04_ECHO_GPIO,
@@ -186,7 +279,8 @@ void distance_sensor_setup(mcpwm_cap_timer_handle_t timer_handle)
     };
     esp_timer_handle_t periodic_handle = NULL;
     ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_handle));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_handle, DISTANCE_MEAS_PERIOD_MS * 1E3));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_handle, period_ms * 1E3));
+    return periodic_handle;
 }
 
 void throttle_out_setup(void)
@@ -214,37 +308,83 @@ void throttle_out_setup(void)
 
 void sensors_init(void)
 {
-    mcpwm_cap_timer_handle_t timer_handle = capture_timer_setup(1);
-    ESP_ERROR_CHECK(mcpwm_capture_timer_enable(timer_handle));
-    ESP_ERROR_CHECK(mcpwm_capture_timer_start(timer_handle));
-    distance_sensor_setup(timer_handle);
-    throttle_in_setup(timer_handle);
-    tachometer_setup();
+    //a single capture timer is shared by every sensor read with an MCPWM capture channel
+#define USES_CAPTURE_TIMER(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) \
+    || (periph) == SENSOR_PERIPH_MCPWM_CAP
+    mcpwm_cap_timer_handle_t timer_handle = NULL;
+    if(false SENSOR_REGISTRY(USES_CAPTURE_TIMER))
+    {
+        timer_handle = capture_timer_setup(1);
+        ESP_ERROR_CHECK(mcpwm_capture_timer_enable(timer_handle));
+        ESP_ERROR_CHECK(mcpwm_capture_timer_start(timer_handle));
+    }
+#define SETUP_SENSOR(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) \
+    sensor_timers[SENSOR_ID_##name] = name##_setup(timer_handle, period_ms);
+    SENSOR_REGISTRY(SETUP_SENSOR)
     throttle_out_setup();
 }
 
+sensor_id sensors_find(const char *name)
+{
+    sensor_id id = 0;
+    while(id < SENSOR_COUNT && strcmp(name, sensor_names[id]) != 0)
+    {
+        id++;
+    }
+    return id;
+}
+const char *sensors_name(sensor_id id)
+{
+    assert(id < SENSOR_COUNT);
+    return sensor_names[id];
+}
+uint32_t sensors_get_period_ms(sensor_id id)
+{
+    assert(id < SENSOR_COUNT);
+    return sensor_period_ms[id];
+}
+esp_err_t sensors_check_period_ms(sensor_id id, uint32_t period_ms)
+{
+    assert(id < SENSOR_COUNT);
+    if(sensor_timers[id] == NULL)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if(period_ms < sensor_min_period_ms[id] || period_ms > sensor_max_period_ms[id])
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sensors_set_period_ms(sensor_id id, uint32_t period_ms)
+{
+    esp_err_t err = sensors_check_period_ms(id, period_ms);
+    if(err != ESP_OK)
+    {
+        return err;
+    }
+    //esp_timer_stop() fails if the timer is not running, which is not an error here
+    esp_timer_stop(sensor_timers[id]);
+    err = esp_timer_start_periodic(sensor_timers[id], period_ms * 1E3);
+    if(err == ESP_OK)
+    {
+        sensor_period_ms[id] = period_ms;
+    }
+    return err;
+}
+
 float get_velocity(void)
 {
-    taskENTER_CRITICAL(&tachometer_spinlock);
-    float rot_s = tachometer_counts / 
-                  TACHO_COUNTS_PER_REVOLUTION *
-                  (6E4/VELO_MEAS_PERIOD_MS);
-    taskEXIT_CRITICAL(&tachometer_spinlock);
-    return rot_s;
+    return tacho_counts_to_rpm(tachometer_read());
 }
 float get_throttle_in_duty(void)
 {
-    taskENTER_CRITICAL(&throttle_in_spinlock);
-    uint32_t out = throttle_in_duty_ticks;
-    taskEXIT_CRITICAL(&throttle_in_spinlock);
-    return out * 100.0*PWM_FREQ / esp_clk_apb_freq();
+    return cap_ticks_to_duty(throttle_in_read());
 }
 float get_distance(void)
 {
-    taskENTER_CRITICAL(&echo_spinlock);
-    uint32_t out = echo_tof_ticks;
-    taskEXIT_CRITICAL(&echo_spinlock);
-    return out * (343.0/2 / esp_clk_apb_freq());
+    return tof_ticks_to_m(hc_sr04_read());
 }
 void set_throttle_duty(float duty)
 {
@@ -258,12 +398,12 @@ void get_measurements(measurements_data *data)
 {
     assert(data != NULL);
     data->time_us = esp_timer_get_time();
-    data->rot_velocity = get_velocity();
-    data->throttle_in_duty = get_throttle_in_duty();
-    data->distance = get_distance();
+    //every sensor is read once, so fields derived from the same sensor are consistent
+#define SNAPSHOT_SENSOR(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) \
+    raw_type name##_snapshot = name##_read_sample(&data->samples[SENSOR_ID_##name]);
+    SENSOR_REGISTRY(SNAPSHOT_SENSOR)
+#define CONVERT_FIELD(sensor, field, type, format, header, conversion) data->field = conversion(sensor##_snapshot);
+    SENSOR_FIELDS(CONVERT_FIELD)
+#define CLEAR_FIELD(source, field, type, format, header, conversion) data->field = 0;
+    DERIVED_FIELDS(CLEAR_FIELD)
 }
-void measurements_to_csv(char *buffer, measurements_data *data)
-{
-    assert(buffer != NULL && data != NULL);
-    sprintf(buffer, "%"PRId64", %f, %f, %f\n", data->time_us, data->rot_velocity, data->throttle_in_duty, data->distance);
-}
\ No newline at end of file
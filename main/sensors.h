@@ -14,7 +14,7 @@
  * the LEDC module. Spinlocks are used to ensure interrupt protection of variables holding measurement values.
  * 
  * - <b> Tachometer </b> pulses on #TACHOMETER_GPIO are counted using the PCNT module. Periodic reading of the counter is triggered
- * in every #DISTANCE_MEAS_PERIOD_MS by an esp_timer. Both the rising and falling edges
+ * in every #VELO_MEAS_PERIOD_MS by an esp_timer. Both the rising and falling edges
  * of the tachometer signal are counted, which sum up to #TACHO_COUNTS_PER_REVOLUTION.
  * @note Rotational velocity can be obtained with #get_velocity().
  * 
@@ -38,11 +38,18 @@
  * @note Retreive distance measurements with #get_distance().
  * @note HC-SR04 distance measurement was implemented according to the <b> mcpwm_capture_hc_sr04 </b> project
  * from esp-idf builtin examples. 
+ *
+ * The sensors above are declared in sensor_registry.h. The #measurements_data struct is generated
+ * from that table, its transmitted encodings are generated in telemetry.h. Sampling periods of
+ * timer driven sensors can be changed at runtime with #sensors_set_period_ms().
  */
 #ifndef SENSORS_H
-#define SENSOR_H
+#define SENSORS_H
 
 #include <inttypes.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "sensor_registry.h"
 
 /** @name GPIO pins
  * @{
@@ -77,6 +84,10 @@
  * @brief sample rate for reading cumulated counts on tachometer [ms]
 */
 #define VELO_MEAS_PERIOD_MS 200
+/** @def VELO_MEAS_PERIOD_MAX_MS
+ * @brief longest tachometer reading period selectable at runtime, sets the pulse counter limit [ms]
+*/
+#define VELO_MEAS_PERIOD_MAX_MS 500
 /** @def DISTANCE_MEAS_PERIOD_MS
  * @brief sample rate of distance measurements [ms]
 */
@@ -96,6 +107,11 @@
  * @brief tachometer resolution [counts/revolution]
 */
 #define TACHO_COUNTS_PER_REVOLUTION 8
+/** @def TACHO_M_PER_REVOLUTION
+ * @brief distance travelled by the car per revolution seen by the tachometer [m], set by
+ * CONFIG_RC_CAR_WHEEL_CIRCUMFERENCE_MM
+*/
+#define TACHO_M_PER_REVOLUTION (CONFIG_RC_CAR_WHEEL_CIRCUMFERENCE_MM / 1000.0)
 /** @def PWM_FREQ
  * @brief pwm frequency of speed controller [Hz]
 */
@@ -106,19 +122,39 @@
 #define THROTTLE_STATIONARY_DUTY 11.258452
 /**@}*/
 
-//A measurements csv row (1 * uintt64_t + 3 * float), s well as
-//the csv header and other transmitted messages need to fit in  
-#define CSV_BUFF_SIZE 60
+/** @def SENSOR_FIELD_COUNT
+ * @brief number of fields declared in #SENSOR_FIELDS
+ */
+#define SENSOR_FIELD_PLUS_ONE(...) + 1
+#define SENSOR_FIELD_COUNT (0 SENSOR_FIELDS(SENSOR_FIELD_PLUS_ONE))
+/** @def MEASUREMENT_FIELD_COUNT
+ * @brief number of fields declared in #MEASUREMENT_FIELDS
+ */
+#define MEASUREMENT_FIELD_COUNT (0 MEASUREMENT_FIELDS(SENSOR_FIELD_PLUS_ONE))
+
+/**
+ * @brief Identify a sensor of #SENSOR_REGISTRY.
+ */
+typedef enum sensor_id{
+#define SENSOR_ID_ENUMERATOR(name, raw_type, periph, sampling, period_ms, min_period_ms, max_period_ms) SENSOR_ID_##name,
+    SENSOR_REGISTRY(SENSOR_ID_ENUMERATOR)
+#undef SENSOR_ID_ENUMERATOR
+    SENSOR_COUNT
+} sensor_id;
 
 /**
- * @brief Hold measurement values and a timestamp.
+ * @brief Hold measurement values and a timestamp. Fields are generated from #MEASUREMENT_FIELDS.
  * 
+ * @details <b>samples</b> counts the values published by each sensor modulo 256, a changed
+ * count tells a new reading apart from a repeated one whatever the sampling period is. It is
+ * not transmitted.
  */
 typedef struct measurements_data{
     uint64_t time_us;
-    float rot_velocity;
-    float throttle_in_duty;
-    float distance;
+    uint8_t samples[SENSOR_COUNT];
+#define MEASUREMENTS_DATA_MEMBER(sensor, field, type, format, header, conversion) type field;
+    MEASUREMENT_FIELDS(MEASUREMENTS_DATA_MEMBER)
+#undef MEASUREMENTS_DATA_MEMBER
 } measurements_data;
 
 /**
@@ -126,11 +162,49 @@ typedef struct measurements_data{
  */
 void sensors_init(void);
 
+/**
+ * @brief Look up a sensor by the name it is registered with.
+ * 
+ * @param name - sensor name in #SENSOR_REGISTRY
+ * @return id of the sensor, #SENSOR_COUNT if there is no such sensor
+ */
+sensor_id sensors_find(const char *name);
+
+/**
+ * @brief Get the name a sensor is registered with.
+ */
+const char *sensors_name(sensor_id id);
+
+/**
+ * @brief Get the current sampling period of a sensor, 0 for capture driven sensors [ms].
+ */
+uint32_t sensors_get_period_ms(sensor_id id);
+
+/**
+ * @brief Check whether a sampling period could be set with #sensors_set_period_ms().
+ * 
+ * @param id - sensor to check
+ * @param period_ms - sampling period [ms]
+ * @return ESP_OK if it could, ESP_ERR_NOT_SUPPORTED for capture driven sensors,
+ * ESP_ERR_INVALID_ARG if the period is out of the range declared in #SENSOR_REGISTRY
+ */
+esp_err_t sensors_check_period_ms(sensor_id id, uint32_t period_ms);
+
+/**
+ * @brief Change the sampling period of a timer driven sensor without stopping the measurements.
+ * 
+ * @param id - sensor to reconfigure
+ * @param period_ms - new sampling period [ms]
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for capture driven sensors,
+ * ESP_ERR_INVALID_ARG if the period is out of the range declared in #SENSOR_REGISTRY
+ */
+esp_err_t sensors_set_period_ms(sensor_id id, uint32_t period_ms);
+
 /**
  * @brief Get last tachometer measurement taken on #TACHOMETER_GPIO.
  * 
  * @details Compute rotational velocity from tachometer data with the following formula:
- * \f{equation}{rotational velocity = \frac{tachometer\_counts * 60000}{TACHO\_COUNTS\_PER\_REVOLUTION * VELO\_MEAS\_PERIOD\_MS}\f}
+ * \f{equation}{rotational velocity = \frac{tachometer\_counts * 60000000}{TACHO\_COUNTS\_PER\_REVOLUTION * reading\_interval\_us}\f}
  * 
  * @return rotational velocity [rot/min] 
  */
@@ -160,17 +234,11 @@ float get_distance(void);
 void set_throttle_duty(float duty);
 /**
  * @brief get a #measurement_data instance with current measurements and a timestamp in microseconds.
- * Time is retrieved via esp_timer::esp_timer_get_time(), measured since boot time.
+ * Time is retrieved via esp_timer::esp_timer_get_time(), measured since boot time. Fields of
+ * #DERIVED_FIELDS are cleared, they are filled by #sensor_filter_step().
  * 
  * @param pointer to measurements_data instance which will be updated
  */
 void get_measurements(measurements_data *data);
-/**
- * @brief Convert measurement data into csv format, write result into <b>buffer</b>.
- * 
- * @param buffer - char array destination
- * @param data - a measurement_data struct
- */
-void measurements_to_csv(char *buffer, measurements_data *data);
 
 #endif // __SENSORS_H__
\ No newline at end of file
@@ -7,68 +7,333 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include "tcp_server.h"
+#include "tcp_transport.h"
+#include "pipeline.h"
+#include "telemetry.h"
+#include "control_channel.h"
+#include "clock_sync.h"
+#include "deferred_log.h"
+#include "burst.h"
+#include "boot_time.h"
+#include "wifi_station.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_system.h"
-#include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
-#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
 
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include <lwip/netdb.h>
-
-#define PORT                        CONFIG_EXAMPLE_PORT
-#define KEEPALIVE_IDLE              CONFIG_EXAMPLE_KEEPALIVE_IDLE
-#define KEEPALIVE_INTERVAL          CONFIG_EXAMPLE_KEEPALIVE_INTERVAL
-#define KEEPALIVE_COUNT             CONFIG_EXAMPLE_KEEPALIVE_COUNT
-#define TX_BUFF_SIZE 60
+//longest incoming command line, fits a pong with three 64 bit timestamps
+#define CONTROL_LINE_MAX            96
+//period of the transmit statistics sent to the client
+#define TX_STAT_PERIOD_MS           10000
+//longest transmit benchmark [s]
+#define TX_BENCH_MAX_S              60
 
 static const char *TAG = "tcp_server";
 
-//csv header belonging to measurements_to_csv() from sensors.h
-static const char *header = "time[us], rot/min, throttle in duty[\%], distance[m]\n";
+//csv headers belonging to telemetry_to_csv() from telemetry.h
+static const char *header = TELEMETRY_CSV_HEADER TELEMETRY_AGGREGATE_CSV_HEADER;
 
 //indicate server-client connection state to other tasks
 enum TCP_server_state server_state = Disconnected;
 
-static void do_transmit(const int sock, QueueHandle_t xStringQueue)
+//lines of a frozen burst, uploaded between batches
+static char burst_buff[BURST_UPLOAD_SIZE];
+//partially received command line
+static char rx_buff[CONTROL_LINE_MAX + 1];
+static size_t rx_len = 0;
+//clock synchronisation with the connected client
+static clock_sync client_clock;
+//duration of the transmit benchmark requested by the client [s], 0 if none
+static uint32_t tx_bench_s = 0;
+
+//cost of the telemetry transmission since the last report
+typedef struct tx_stat{
+    int64_t start_us;
+    uint32_t bytes;
+    //bytes encoded within a single core, the encode cycles belong to them
+    uint32_t encoded_bytes;
+    uint32_t encode_cycles;
+    //transport_tx_cost() at the start of the window
+    uint32_t tx_cycles;
+    uint32_t tx_bytes;
+    //aggregator_extended_windows() at the start of the window
+    uint32_t extended_windows;
+} tx_stat;
+
+static void tx_stat_restart(tx_stat *stat)
 {
-    char tx_buff[TX_BUFF_SIZE];
-    //transmit header to every client once
-    size_t len = strlen(header);
-    size_t to_write = len;
-    while (to_write > 0) {
-        int written = send(sock, header + (len - to_write), to_write, 0);
-        if (written < 0) {
-            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-            return;
+    stat->start_us = esp_timer_get_time();
+    stat->bytes = 0;
+    stat->encoded_bytes = 0;
+    stat->encode_cycles = 0;
+    transport_tx_cost(&stat->tx_cycles, &stat->tx_bytes);
+    stat->extended_windows = aggregator_extended_windows();
+}
+
+/* format a #txstat or #txbench line: telemetry bytes and throughput of the window, cycles per
+byte spent encoding them and transmitting them through the backend, and the aggregation windows
+extended because the telemetry queue was full*/
+static size_t tx_stat_report(tx_stat *stat, const char *name, char *buffer)
+{
+    uint32_t elapsed_ms = (esp_timer_get_time() - stat->start_us) / 1000;
+    uint32_t tx_cycles;
+    uint32_t tx_bytes;
+    transport_tx_cost(&tx_cycles, &tx_bytes);
+    int len = snprintf(buffer, TX_STAT_SIZE,
+                       "#%s backend=" TRANSPORT_BACKEND " bytes=%"PRIu32" ms=%"PRIu32" kBps=%.1f encode_cpb=%.1f tx_cpb=%.1f extended=%"PRIu32"\n",
+                       name, stat->bytes, elapsed_ms, (float)stat->bytes / MAX(elapsed_ms, 1),
+                       (float)stat->encode_cycles / MAX(stat->encoded_bytes, 1),
+                       (float)(tx_cycles - stat->tx_cycles) / MAX(tx_bytes - stat->tx_bytes, 1),
+                       aggregator_extended_windows() - stat->extended_windows);
+    tx_stat_restart(stat);
+    return len < TX_STAT_SIZE ? len : TX_STAT_SIZE - 1;
+}
+
+//encode a record, the cycle counters of the cores are independent, an encoding the task
+//was migrated during is left out of the encode cycles
+static size_t encode_record(tx_stat *stat, uint8_t *buffer, const telemetry_record *record,
+                            output_format format)
+{
+    int core = xPortGetCoreID();
+    uint32_t encode_start = esp_cpu_get_cycle_count();
+    size_t len;
+    if (format == OUTPUT_FORMAT_BIN) {
+        len = telemetry_to_bin(buffer, record);
+    } else {
+        len = telemetry_to_csv((char *)buffer, record);
+    }
+    uint32_t cycles = esp_cpu_get_cycle_count() - encode_start;
+    if (xPortGetCoreID() == core) {
+        stat->encode_cycles += cycles;
+        stat->encoded_bytes += len;
+    }
+    return len;
+}
+
+//parse a txbench command, the benchmark itself is run by do_transmit()
+static size_t tx_bench_command(const char *line, char *reply)
+{
+    char *end = NULL;
+    unsigned long seconds = strtoul(line, &end, 10);
+    if (end == line || *end != '\0' || seconds < 1 || seconds > TX_BENCH_MAX_S) {
+        return snprintf(reply, CONTROL_REPLY_SIZE, "#err txbench seconds 1-%d\n", TX_BENCH_MAX_S);
+    }
+    tx_bench_s = seconds;
+    return snprintf(reply, CONTROL_REPLY_SIZE, "#ok txbench %lu\n", seconds);
+}
+
+/* send full batches of the record as fast as the transport accepts them for tx_bench_s seconds,
+the saturated throughput and its cost are reported in a #txbench line*/
+static bool run_tx_bench(const telemetry_record *record, output_format format)
+{
+    tx_stat stat;
+    tx_stat_restart(&stat);
+    int64_t end_us = stat.start_us + (int64_t)tx_bench_s * 1000000;
+    tx_bench_s = 0;
+    while (esp_timer_get_time() < end_us) {
+        uint8_t *tx_buff = transport_tx_slot();
+        if (tx_buff == NULL) {
+            return false;
+        }
+        size_t len = 0;
+        for (int i = 0; i < MAX_BATCH; i++) {
+            len += encode_record(&stat, tx_buff + len, record, format);
+        }
+        if (!transport_send_slot(len)) {
+            return false;
         }
-        to_write -= written;
+        stat.bytes += len;
     }
-    //clear old data in StringQueue
-    xQueueReset(xStringQueue);
-    //transmit strings received from measurements_task
+    char report[TX_STAT_SIZE];
+    return transport_send(report, tx_stat_report(&stat, "txbench", report));
+}
+
+//answer every complete command line received so far, waits at most timeout_ms for data
+static bool poll_commands(uint32_t timeout_ms)
+{
+    int received = transport_recv(rx_buff + rx_len, CONTROL_LINE_MAX - rx_len, timeout_ms);
+    if (received < 0) {
+        return false;
+    }
+    if (received == 0) {
+        return true;
+    }
+    //receive time of pong answers to clock_sync pings
+    int64_t rx_time_us = esp_timer_get_time();
+    rx_len += received;
+    rx_buff[rx_len] = '\0';
+    char reply[MAX(CONTROL_REPLY_SIZE, CLOCK_SYNC_MSG_SIZE)];
+    char *line = rx_buff;
+    char *line_end = NULL;
+    while ((line_end = memchr(line, '\n', rx_len - (line - rx_buff))) != NULL) {
+        *line_end = '\0';
+        size_t reply_len = 0;
+        if (strncmp(line, "pong ", 5) == 0) {
+            if (clock_sync_pong(&client_clock, line, rx_time_us)) {
+                reply_len = clock_sync_report(&client_clock, reply);
+            }
+        } else if (strncmp(line, "txbench ", 8) == 0) {
+            reply_len = tx_bench_command(line + 8, reply);
+        } else {
+            reply_len = control_handle_command(line, reply);
+        }
+        if (!transport_send(reply, reply_len)) {
+            return false;
+        }
+        line = line_end + 1;
+    }
+    rx_len -= line - rx_buff;
+    memmove(rx_buff, line, rx_len);
+    //a line longer than the buffer can not be a valid command
+    if (rx_len == CONTROL_LINE_MAX) {
+        rx_len = 0;
+        const char *error = "#err command too long\n";
+        return transport_send(error, strlen(error));
+    }
+    return true;
+}
+
+//send a ping and wait a short time for the pong, so it is timestamped when it arrives
+static bool ping_client(void)
+{
+    char ping[CLOCK_SYNC_MSG_SIZE];
+    if (!transport_send(ping, clock_sync_ping(&client_clock, esp_timer_get_time(), ping))) {
+        return false;
+    }
+    //on timeout the pong is received by a later poll, the delay it reports is filtered out
+    return poll_commands(CLOCK_SYNC_TIMEOUT_MS);
+}
+
+static void do_transmit(const pipeline_handles *pipeline)
+{
+    QueueHandle_t xTelemetryQueue = pipeline->queues.telemetry_queue;
+    int64_t next_ping_us = esp_timer_get_time();
+    int64_t next_mem_report_us = next_ping_us;
+    int64_t next_jitter_report_us = next_ping_us + JITTER_REPORT_PERIOD_MS * 1000;
+    int64_t next_tx_stat_us = next_ping_us + TX_STAT_PERIOD_MS * 1000;
+    tx_stat stat;
+    tx_stat_restart(&stat);
+    //transmit header and boot phase times to every client once
+    if (!transport_send(header, strlen(header))) {
+        return;
+    }
+    char boot_report[BOOT_TIME_REPORT_SIZE];
+    if (!transport_send(boot_report, boot_time_report(boot_report))) {
+        return;
+    }
+    rx_len = 0;
+    tx_bench_s = 0;
+    clock_sync_reset(&client_clock);
+    burst_upload_restart();
+    //clear old data in the queue
+    xQueueReset(xTelemetryQueue);
+    //last record received, repeated by the transmit benchmark
+    telemetry_record record = {0};
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+    QueueHandle_t xLoadQueue = pipeline->queues.jitter_load_queue;
+    //first record of the connection, encoded for every load token of the jitter benchmark
+    telemetry_record load_record = {0};
+    xQueueReset(xLoadQueue);
+#endif
+    //transmit records received from measurements_task in batches,
+    //commands are polled at least every CONTROL_POLL_MS
     while (true) {
-        if (xQueueReceive(xStringQueue, &tx_buff, portMAX_DELAY)) {
-            ESP_LOGI(TAG, "transmitting %zu bytes", strlen(tx_buff));
-            // send() can return less bytes than supplied length.
-            // Walk-around for robust implementation.
-            len = strlen(tx_buff);
-            to_write = len;
-            while (to_write > 0) {
-                int written = send(sock, tx_buff + (len - to_write), to_write, 0);
-                if (written < 0) {
-                    ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                    return;
+        stream_config config;
+        stream_config_get(&config);
+        size_t len = 0;
+        uint32_t batched = 0;
+        //encoded in place into the transmit ring
+        uint8_t *tx_buff = transport_tx_slot();
+        if (tx_buff == NULL) {
+            return;
+        }
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CONTROL_POLL_MS);
+        while (batched < config.batch_size) {
+            TickType_t remaining = deadline - xTaskGetTickCount();
+            if ((int32_t)remaining < 0) {
+                break;
+            }
+            TickType_t wait = remaining;
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+            uint8_t token;
+            if (load_record.count > 0 && xQueueReceive(xLoadQueue, &token, 0)) {
+                len += encode_record(&stat, tx_buff + len, &load_record, config.format);
+                batched++;
+                continue;
+            }
+            //the wait for a record is sliced into ticks, so the load tokens do not queue up behind it
+            wait = MIN(remaining, 1);
+#endif
+            if (!xQueueReceive(xTelemetryQueue, &record, wait)) {
+                if (wait == remaining) {
+                    break;
                 }
-                to_write -= written;
+                continue;
+            }
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+            if (load_record.count == 0) {
+                load_record = record;
+            }
+#endif
+            len += encode_record(&stat, tx_buff + len, &record, config.format);
+            batched++;
+        }
+        if (len > 0) {
+            DLOG(DLOG_TCP_TRANSMIT, len);
+            if (!transport_send_slot(len)) {
+                return;
+            }
+            stat.bytes += len;
+        }
+        //a frozen burst is uploaded in chunks, so batches keep flowing
+        size_t burst_len = burst_upload(burst_buff);
+        if (burst_len > 0 && !transport_send(burst_buff, burst_len)) {
+            return;
+        }
+        if (!poll_commands(0)) {
+            return;
+        }
+        if (tx_bench_s > 0) {
+            //the last record received is repeated, the records produced meanwhile are dropped
+            if (!run_tx_bench(&record, config.format)) {
+                return;
+            }
+            xQueueReset(xTelemetryQueue);
+            tx_stat_restart(&stat);
+        }
+        if (esp_timer_get_time() >= next_ping_us) {
+            next_ping_us += CLOCK_SYNC_PERIOD_MS * 1000;
+            if (!ping_client()) {
+                return;
+            }
+        }
+        if (esp_timer_get_time() >= next_mem_report_us) {
+            next_mem_report_us += PIPELINE_MEM_REPORT_PERIOD_MS * 1000;
+            char report[PIPELINE_REPORT_SIZE];
+            if (!transport_send(report, pipeline_memory_report(report))) {
+                return;
+            }
+        }
+        if (esp_timer_get_time() >= next_jitter_report_us) {
+            next_jitter_report_us += JITTER_REPORT_PERIOD_MS * 1000;
+            char report[JITTER_REPORT_SIZE];
+            if (!transport_send(report, jitter_bench_report(report))) {
+                return;
+            }
+        }
+        if (esp_timer_get_time() >= next_tx_stat_us) {
+            next_tx_stat_us += TX_STAT_PERIOD_MS * 1000;
+            char report[TX_STAT_SIZE];
+            if (!transport_send(report, tx_stat_report(&stat, "txstat", report))) {
+                return;
             }
         }
     }
@@ -76,93 +341,57 @@ static void do_transmit(const int sock, QueueHandle_t xStringQueue)
 
 void tcp_server_task(void *pvParameters)
 {
-    char addr_str[128];
-    QueueHandle_t xStringQueue = (QueueHandle_t)pvParameters;
-    int ip_protocol = 0;
-    int keepAlive = 1;
-    int keepIdle = KEEPALIVE_IDLE;
-    int keepInterval = KEEPALIVE_INTERVAL;
-    int keepCount = KEEPALIVE_COUNT;
-    struct sockaddr_storage dest_addr;
-
-#ifdef CONFIG_EXAMPLE_IPV4
-    int addr_family = AF_INET;
-    struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
-    dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
-    dest_addr_ip4->sin_family = AF_INET;
-    dest_addr_ip4->sin_port = htons(PORT);
-    ip_protocol = IPPROTO_IP;
-#elif defined(CONFIG_EXAMPLE_IPV6)
-    int addr_family = AF_INET6;
-    struct sockaddr_in6 *dest_addr_ip6 = (struct sockaddr_in6 *)&dest_addr;
-    bzero(&dest_addr_ip6->sin6_addr.un, sizeof(dest_addr_ip6->sin6_addr.un));
-    dest_addr_ip6->sin6_family = AF_INET6;
-    dest_addr_ip6->sin6_port = htons(PORT);
-    ip_protocol = IPPROTO_IPV6;
+    char addr_str[TCP_SERVER_ADDR_SIZE];
+    const pipeline_handles *pipeline = (const pipeline_handles *)pvParameters;
+
+#if CONFIG_RC_CAR_JITTER_BENCHMARK
+    //the load timer interrupt is allocated on the core of this task
+    if (jitter_load_start(pipeline->queues.jitter_load_queue) != ESP_OK) {
+        ESP_LOGE(TAG, "jitter benchmark load could not be started");
+    }
 #endif
 
-    int listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
-    if (listen_sock < 0) {
-        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    //the network is brought up here, so the control tasks never wait for it,
+    //the socket listens before the station has an IP address
+    esp_err_t err = nvs_init();
+    if (err == ESP_OK) {
+        boot_time_mark(BOOT_PHASE_nvs);
+        err = wifi_init_sta();
+    }
+    if (err != ESP_OK) {
+        //the car keeps driving, only the telemetry is lost
+        ESP_LOGE(TAG, "network could not be brought up: %s, running without it", esp_err_to_name(err));
         vTaskDelete(NULL);
         return;
     }
-    int opt = 1;
-    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    ESP_LOGI(TAG, "Socket created");
-
-    int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (err != 0) {
-        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
-        ESP_LOGE(TAG, "IPPROTO: %d", addr_family);
-        goto CLEAN_UP;
-    }
-    ESP_LOGI(TAG, "Socket bound, port %d", PORT);
 
-    err = listen(listen_sock, 1);
-    if (err != 0) {
-        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
-        goto CLEAN_UP;
+    if (transport_listen() != ESP_OK) {
+        vTaskDelete(NULL);
+        return;
     }
+    boot_time_mark(BOOT_PHASE_listen);
 
-    while (1) {
-
-        ESP_LOGI(TAG, "Socket listening");
-
-        struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
-        socklen_t addr_len = sizeof(source_addr);
-        int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
-            break;
-        }
-
-        // Set tcp keepalive option
-        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
-        // Convert ip address to string
-        if (source_addr.ss_family == PF_INET) {
-            inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
+    while (true) {
+        err = transport_accept(addr_str, sizeof(addr_str), TCP_SERVER_ACCEPT_POLL_MS);
+        if (err == ESP_ERR_TIMEOUT) {
+            //no client yet, a reconnect attempt the station could not schedule is made here
+            wifi_sta_retry();
+            continue;
         }
-    #ifdef CONFIG_EXAMPLE_IPV6
-        else if (source_addr.ss_family == PF_INET6) {
-            inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
+        if (err != ESP_OK) {
+            break;
         }
-    #endif
+        boot_time_mark(BOOT_PHASE_client);
         server_state = Connected;
-        ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
+        ESP_LOGI(TAG, "Client accepted ip address: %s", addr_str);
 
-        do_transmit(sock, xStringQueue);
+        do_transmit(pipeline);
 
         server_state = Disconnected;
-        shutdown(sock, 0);
-        close(sock);
+        transport_close();
+        //a burst whose upload was interrupted may be replaced until the next client
+        burst_upload_restart();
     }
 
-CLEAN_UP:
-    close(listen_sock);
     vTaskDelete(NULL);
 }
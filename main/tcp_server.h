@@ -14,6 +14,19 @@
 #ifndef TCP_SERVER_H
 #define TCP_SERVER_H
 
+/** @def TX_STAT_SIZE
+ * @brief A transmit statistics line including the terminating null character needs to fit in.
+ */
+#define TX_STAT_SIZE 160
+/** @def TCP_SERVER_ADDR_SIZE
+ * @brief address of the client as text, including the terminating null character
+ */
+#define TCP_SERVER_ADDR_SIZE 128
+/** @def TCP_SERVER_ACCEPT_POLL_MS
+ * @brief period the server checks for a lost reconnect attempt of the station while it waits for a client [ms]
+ */
+#define TCP_SERVER_ACCEPT_POLL_MS 1000
+
 enum TCP_server_state{
     Connected,
     Disconnected
@@ -25,10 +38,20 @@ enum TCP_server_state{
 extern enum TCP_server_state server_state; 
 
 /**
- * @brief Initialise and run tcp server to send messages to client periodically.
+ * @brief Initialise and run tcp server to send measurements to client periodically.
+ * Measurements are encoded and batched according to the stream configuration, and
+ * commands received from the client are handled, see control_channel.h. The clock of the
+ * client is tracked with periodic ping messages, see clock_sync.h, and memory usage is reported
+ * periodically, see #pipeline_memory_report(). The connection is made by the backend of
+ * tcp_transport.h, whose throughput and CPU cost per byte are reported in <b>#txstat</b> lines.
+ * The CPU cost is counted with the cycle counter, for the encoding and for the transmit path of
+ * the backend, see #transport_tx_cost(). The client may request <b>txbench</b> <i>s</i>, which sends full batches of the
+ * last record for s seconds as fast as the backend takes them and reports the saturated
+ * throughput in a <b>#txbench</b> line, see pc_side/tx_sink.py.
+ * NVS and Wi-Fi are brought up by this task before listening, the boot phase times are sent
+ * to every client in a <b>#boot</b> line, see boot_time.h.
  * 
- * @param pvParameters - pointer to char array, which needs to be transmitted.
- * Content of the array can change between two transmission cycles.
+ * @param pvParameters - pointer to the #pipeline_handles, records of its telemetry queue are transmitted.
  */
 void tcp_server_task(void *pvParameters);
 
@@ -0,0 +1,466 @@
+#include "tcp_transport.h"
+#include "pipeline.h"
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+
+#define PORT                        CONFIG_EXAMPLE_PORT
+#define KEEPALIVE_IDLE              CONFIG_EXAMPLE_KEEPALIVE_IDLE
+#define KEEPALIVE_INTERVAL          CONFIG_EXAMPLE_KEEPALIVE_INTERVAL
+#define KEEPALIVE_COUNT             CONFIG_EXAMPLE_KEEPALIVE_COUNT
+
+static const char *TAG = "tcp_transport";
+
+//batches of encoded records, only one client is served at a time
+static uint8_t tx_ring[TRANSPORT_TX_SLOTS][TELEMETRY_TX_BUFF_SIZE];
+//cost of the batches, see transport_tx_cost(), written by the transmitting task only
+static uint32_t tx_cycles = 0;
+static uint32_t tx_bytes = 0;
+
+//a measured span of the transmit path, on the core it was started on
+typedef struct tx_span{
+    int core;
+    uint32_t start;
+} tx_span;
+
+static inline tx_span tx_span_start(void)
+{
+    tx_span span = {
+        .core = xPortGetCoreID(),
+        .start = esp_cpu_get_cycle_count(),
+    };
+    return span;
+}
+
+//the cycle counters of the cores are independent, a span the task was migrated during is left out
+static inline void tx_span_end(const tx_span *span, size_t bytes)
+{
+    uint32_t cycles = esp_cpu_get_cycle_count() - span->start;
+    if (xPortGetCoreID() == span->core) {
+        tx_cycles += cycles;
+        tx_bytes += bytes;
+    }
+}
+
+void transport_tx_cost(uint32_t *cycles, uint32_t *bytes)
+{
+    *cycles = tx_cycles;
+    *bytes = tx_bytes;
+}
+
+#if CONFIG_RC_CAR_TX_NETCONN
+
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+
+//longest wait for the acknowledgement of the ring when the client is disconnected
+#define TRANSPORT_CLOSE_TIMEOUT_MS  1000
+
+static struct netconn *listen_conn = NULL;
+static struct netconn *client_conn = NULL;
+//received data not yet passed to the caller
+static struct pbuf *rx_pbuf = NULL;
+static uint16_t rx_offset = 0;
+//task woken up by acknowledgements
+static TaskHandle_t tx_waiter = NULL;
+//sequence number following the last byte of every slot, slots in flight precede slot_head
+static uint32_t slot_end_seq[TRANSPORT_TX_SLOTS];
+static unsigned slot_head = 0;
+static unsigned slots_in_flight = 0;
+
+//called from the tcpip thread
+static void transport_event(struct netconn *conn, enum netconn_evt evt, uint16_t len)
+{
+    if (evt == NETCONN_EVT_SENDPLUS && tx_waiter != NULL) {
+        xTaskNotifyGive(tx_waiter);
+    }
+}
+
+//release slots acknowledged by the client
+static void release_acked(void)
+{
+    tx_span span = tx_span_start();
+    LOCK_TCPIP_CORE();
+    //a failed connection has freed its segments, no slot is referenced any more
+    const struct tcp_pcb *pcb = client_conn->pcb.tcp;
+    while (slots_in_flight > 0) {
+        unsigned oldest = (slot_head + TRANSPORT_TX_SLOTS - slots_in_flight) % TRANSPORT_TX_SLOTS;
+        if (pcb != NULL && (int32_t)(pcb->lastack - slot_end_seq[oldest]) < 0) {
+            break;
+        }
+        slots_in_flight--;
+    }
+    UNLOCK_TCPIP_CORE();
+    tx_span_end(&span, 0);
+}
+
+esp_err_t transport_listen(void)
+{
+#ifdef CONFIG_EXAMPLE_IPV4
+    listen_conn = netconn_new_with_callback(NETCONN_TCP, transport_event);
+#elif defined(CONFIG_EXAMPLE_IPV6)
+    listen_conn = netconn_new_with_callback(NETCONN_TCP_IPV6, transport_event);
+#endif
+    if (listen_conn == NULL) {
+        ESP_LOGE(TAG, "Unable to create netconn");
+        return ESP_FAIL;
+    }
+#ifdef CONFIG_EXAMPLE_IPV4
+    err_t err = netconn_bind(listen_conn, IP_ADDR_ANY, PORT);
+#elif defined(CONFIG_EXAMPLE_IPV6)
+    err_t err = netconn_bind(listen_conn, IP6_ADDR_ANY, PORT);
+#endif
+    if (err == ERR_OK) {
+        ESP_LOGI(TAG, "Netconn bound, port %d", PORT);
+        err = netconn_listen(listen_conn);
+    }
+    if (err == ERR_OK) {
+        ESP_LOGI(TAG, "Netconn listening");
+    }
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Unable to listen: err %d", err);
+        netconn_delete(listen_conn);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t transport_accept(char *addr_str, size_t addr_len, uint32_t timeout_ms)
+{
+    netconn_set_recvtimeout(listen_conn, timeout_ms);
+    err_t err = netconn_accept(listen_conn, &client_conn);
+    if (err == ERR_TIMEOUT) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Unable to accept connection: err %d", err);
+        netconn_delete(listen_conn);
+        return ESP_FAIL;
+    }
+    tx_waiter = xTaskGetCurrentTaskHandle();
+    slot_head = 0;
+    slots_in_flight = 0;
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb *pcb = client_conn->pcb.tcp;
+    if (pcb != NULL) {
+        ip_set_option(pcb, SOF_KEEPALIVE);
+        pcb->keep_idle = KEEPALIVE_IDLE * 1000;
+        pcb->keep_intvl = KEEPALIVE_INTERVAL * 1000;
+        pcb->keep_cnt = KEEPALIVE_COUNT;
+    }
+    UNLOCK_TCPIP_CORE();
+    ip_addr_t addr;
+    uint16_t port;
+    addr_str[0] = '\0';
+    if (netconn_peer(client_conn, &addr, &port) == ERR_OK) {
+        ipaddr_ntoa_r(&addr, addr_str, addr_len);
+    }
+    return ESP_OK;
+}
+
+void transport_close(void)
+{
+    //lwIP references the slots until they are acknowledged, they are reused by the next client
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(TRANSPORT_CLOSE_TIMEOUT_MS);
+    release_acked();
+    while (slots_in_flight > 0 && (int32_t)(deadline - xTaskGetTickCount()) > 0) {
+        ulTaskNotifyTake(pdTRUE, 1);
+        release_acked();
+    }
+    if (slots_in_flight > 0) {
+        //drop the unacknowledged segments with the connection
+        LOCK_TCPIP_CORE();
+        if (client_conn->pcb.tcp != NULL) {
+            tcp_abort(client_conn->pcb.tcp);
+        }
+        UNLOCK_TCPIP_CORE();
+        slots_in_flight = 0;
+    } else {
+        netconn_close(client_conn);
+    }
+    netconn_delete(client_conn);
+    client_conn = NULL;
+    tx_waiter = NULL;
+    if (rx_pbuf != NULL) {
+        pbuf_free(rx_pbuf);
+        rx_pbuf = NULL;
+    }
+}
+
+bool transport_send(const void *data, size_t len)
+{
+    err_t err = netconn_write(client_conn, data, len, NETCONN_COPY);
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Error occurred during sending: err %d", err);
+        return false;
+    }
+    return true;
+}
+
+int transport_recv(char *buffer, size_t max_len, uint32_t timeout_ms)
+{
+    if (rx_pbuf == NULL) {
+        err_t err;
+        if (timeout_ms == 0) {
+            err = netconn_recv_tcp_pbuf_flags(client_conn, &rx_pbuf, NETCONN_DONTBLOCK);
+        } else {
+            netconn_set_recvtimeout(client_conn, timeout_ms);
+            err = netconn_recv_tcp_pbuf(client_conn, &rx_pbuf);
+        }
+        if (err == ERR_WOULDBLOCK || err == ERR_TIMEOUT) {
+            rx_pbuf = NULL;
+            return 0;
+        }
+        if (err != ERR_OK) {
+            if (err == ERR_CLSD) {
+                ESP_LOGI(TAG, "Connection closed");
+            } else {
+                ESP_LOGE(TAG, "Error occurred during receiving: err %d", err);
+            }
+            rx_pbuf = NULL;
+            return -1;
+        }
+        rx_offset = 0;
+    }
+    uint16_t copied = pbuf_copy_partial(rx_pbuf, buffer, MIN(max_len, rx_pbuf->tot_len - rx_offset), rx_offset);
+    rx_offset += copied;
+    if (rx_offset == rx_pbuf->tot_len) {
+        pbuf_free(rx_pbuf);
+        rx_pbuf = NULL;
+    }
+    return copied;
+}
+
+uint8_t *transport_tx_slot(void)
+{
+    release_acked();
+    while (slots_in_flight == TRANSPORT_TX_SLOTS) {
+        ulTaskNotifyTake(pdTRUE, 1);
+        release_acked();
+    }
+    return tx_ring[slot_head];
+}
+
+bool transport_send_slot(size_t len)
+{
+    //the slot is referenced by lwIP instead of being copied, it is written in the parts the
+    //send buffer takes, so the waits for space are left out of the measured spans
+    size_t sent = 0;
+    while (sent < len) {
+        size_t written = 0;
+        tx_span span = tx_span_start();
+        err_t err = netconn_write_partly(client_conn, tx_ring[slot_head] + sent, len - sent,
+                                         NETCONN_NOCOPY | NETCONN_DONTBLOCK, &written);
+        tx_span_end(&span, written);
+        if (err != ERR_OK && err != ERR_WOULDBLOCK) {
+            ESP_LOGE(TAG, "Error occurred during sending: err %d", err);
+            return false;
+        }
+        sent += written;
+        if (sent < len) {
+            ulTaskNotifyTake(pdTRUE, 1);
+        }
+    }
+    //only this task writes, the end of the buffered data is the end of the slot
+    tx_span span = tx_span_start();
+    LOCK_TCPIP_CORE();
+    const struct tcp_pcb *pcb = client_conn->pcb.tcp;
+    slot_end_seq[slot_head] = pcb != NULL ? pcb->snd_lbb : 0;
+    UNLOCK_TCPIP_CORE();
+    tx_span_end(&span, 0);
+    slot_head = (slot_head + 1) % TRANSPORT_TX_SLOTS;
+    slots_in_flight++;
+    return true;
+}
+
+#else //socket backend
+
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include <lwip/netdb.h>
+
+static int listen_sock = -1;
+static int sock = -1;
+
+esp_err_t transport_listen(void)
+{
+    int ip_protocol = 0;
+    struct sockaddr_storage dest_addr;
+
+#ifdef CONFIG_EXAMPLE_IPV4
+    int addr_family = AF_INET;
+    struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
+    dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
+    dest_addr_ip4->sin_family = AF_INET;
+    dest_addr_ip4->sin_port = htons(PORT);
+    ip_protocol = IPPROTO_IP;
+#elif defined(CONFIG_EXAMPLE_IPV6)
+    int addr_family = AF_INET6;
+    struct sockaddr_in6 *dest_addr_ip6 = (struct sockaddr_in6 *)&dest_addr;
+    bzero(&dest_addr_ip6->sin6_addr.un, sizeof(dest_addr_ip6->sin6_addr.un));
+    dest_addr_ip6->sin6_family = AF_INET6;
+    dest_addr_ip6->sin6_port = htons(PORT);
+    ip_protocol = IPPROTO_IPV6;
+#endif
+
+    listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    ESP_LOGI(TAG, "Socket created");
+
+    int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err != 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        ESP_LOGE(TAG, "IPPROTO: %d", addr_family);
+        goto CLEAN_UP;
+    }
+    ESP_LOGI(TAG, "Socket bound, port %d", PORT);
+
+    err = listen(listen_sock, 1);
+    if (err != 0) {
+        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
+        goto CLEAN_UP;
+    }
+    ESP_LOGI(TAG, "Socket listening");
+    return ESP_OK;
+
+CLEAN_UP:
+    close(listen_sock);
+    return ESP_FAIL;
+}
+
+esp_err_t transport_accept(char *addr_str, size_t addr_len, uint32_t timeout_ms)
+{
+    int keepAlive = 1;
+    int keepIdle = KEEPALIVE_IDLE;
+    int keepInterval = KEEPALIVE_INTERVAL;
+    int keepCount = KEEPALIVE_COUNT;
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listen_sock, &readable);
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    if (select(listen_sock + 1, &readable, NULL, NULL, &timeout) == 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
+    socklen_t source_addr_len = sizeof(source_addr);
+    sock = accept(listen_sock, (struct sockaddr *)&source_addr, &source_addr_len);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+        close(listen_sock);
+        return ESP_FAIL;
+    }
+
+    // Set tcp keepalive option
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+    // Convert ip address to string
+    addr_str[0] = '\0';
+    if (source_addr.ss_family == PF_INET) {
+        inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, addr_len - 1);
+    }
+#ifdef CONFIG_EXAMPLE_IPV6
+    else if (source_addr.ss_family == PF_INET6) {
+        inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, addr_len - 1);
+    }
+#endif
+    return ESP_OK;
+}
+
+void transport_close(void)
+{
+    shutdown(sock, 0);
+    close(sock);
+    sock = -1;
+}
+
+bool transport_send(const void *data, size_t len)
+{
+    // send() can return less bytes than supplied length.
+    // Walk-around for robust implementation.
+    size_t to_write = len;
+    while (to_write > 0) {
+        int written = send(sock, (const char *)data + (len - to_write), to_write, 0);
+        if (written < 0) {
+            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+            return false;
+        }
+        to_write -= written;
+    }
+    return true;
+}
+
+int transport_recv(char *buffer, size_t max_len, uint32_t timeout_ms)
+{
+    if (timeout_ms > 0) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(sock, &readable);
+        struct timeval timeout = {
+            .tv_sec = timeout_ms / 1000,
+            .tv_usec = (timeout_ms % 1000) * 1000,
+        };
+        select(sock + 1, &readable, NULL, NULL, &timeout);
+    }
+    int received = recv(sock, buffer, max_len, MSG_DONTWAIT);
+    if (received == 0) {
+        ESP_LOGI(TAG, "Connection closed");
+        return -1;
+    }
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        ESP_LOGE(TAG, "Error occurred during receiving: errno %d", errno);
+        return -1;
+    }
+    return received;
+}
+
+uint8_t *transport_tx_slot(void)
+{
+    return tx_ring[0];
+}
+
+bool transport_send_slot(size_t len)
+{
+    //the wait for space in the send buffer is left out of the measured spans
+    size_t sent = 0;
+    while (sent < len) {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(sock, &writable);
+        select(sock + 1, NULL, &writable, NULL, NULL);
+        tx_span span = tx_span_start();
+        int written = send(sock, tx_ring[0] + sent, len - sent, MSG_DONTWAIT);
+        tx_span_end(&span, MAX(written, 0));
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+            return false;
+        }
+        sent += written;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,109 @@
+/** @file tcp_transport.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Connection of the tcp server to its single client, over BSD sockets or the lwIP netconn API.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details The backend is chosen with <b>RC_CAR_TX_BACKEND</b> under <b>RC Car Pipeline
+ * Configuration</b> in project configuration menu.
+ *
+ * Telemetry batches are encoded into the slots of a transmit ring, see #transport_tx_slot().
+ * - <b>socket</b>: the ring has a single slot, send() copies every batch into lwIP buffers.
+ * - <b>netconn</b>: batches are written with NETCONN_NOCOPY, lwIP references the slot memory
+ *   in its segments until the client acknowledges them, no copy is made. A slot is reused only
+ *   after the acknowledgement of its last byte. Requires LWIP_TCPIP_CORE_LOCKING to read the
+ *   acknowledgement state of the connection.
+ *
+ * Replies and reports are short and sent with #transport_send(), which copies on both backends.
+ *
+ * The transmit path of the batches is measured with the cycle counter of the core running it,
+ * see #transport_tx_cost(): the writes into lwIP and the release of acknowledged slots, without
+ * the waits for space in the send buffer or for acknowledgements. With LWIP_TCPIP_CORE_LOCKING
+ * lwIP and the Wi-Fi driver run the write in the calling task. Without it the socket backend
+ * passes the write to the tcpip task and the span covers the wait for its result.
+ */
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "esp_err.h"
+
+/** @def TRANSPORT_TX_SLOTS
+ * @brief batches waiting for acknowledgement in the transmit ring
+ */
+#if CONFIG_RC_CAR_TX_NETCONN
+#define TRANSPORT_TX_SLOTS 4
+#define TRANSPORT_BACKEND "netconn"
+#else
+#define TRANSPORT_TX_SLOTS 1
+#define TRANSPORT_BACKEND "socket"
+#endif
+
+/**
+ * @brief Create the listening connection on port <b>EXAMPLE_PORT</b>.
+ *
+ * @return ESP_OK on success, ESP_FAIL otherwise
+ */
+esp_err_t transport_listen(void);
+
+/**
+ * @brief Wait for a client to connect.
+ *
+ * @param addr_str - destination of the address of the client
+ * @param addr_len - size of <b>addr_str</b>
+ * @param timeout_ms - longest wait for a client [ms]
+ * @return ESP_OK if a client connected, ESP_ERR_TIMEOUT if none did in <b>timeout_ms</b>,
+ * ESP_FAIL if the listening connection failed, it is closed then
+ */
+esp_err_t transport_accept(char *addr_str, size_t addr_len, uint32_t timeout_ms);
+
+/**
+ * @brief Close the connection of the client, the transmit ring is released before returning.
+ */
+void transport_close(void);
+
+/**
+ * @brief Send <b>len</b> bytes, the data is copied.
+ *
+ * @return false if the connection failed
+ */
+bool transport_send(const void *data, size_t len);
+
+/**
+ * @brief Receive up to <b>max_len</b> bytes.
+ *
+ * @param timeout_ms - longest wait for data, 0 returns immediately
+ * @return number of bytes received, 0 if no data arrived in time, -1 if the connection is closed or failed
+ */
+int transport_recv(char *buffer, size_t max_len, uint32_t timeout_ms);
+
+/**
+ * @brief Get the next slot of the transmit ring, waiting for its previous batch to be acknowledged.
+ *
+ * @return slot of #TELEMETRY_TX_BUFF_SIZE bytes, NULL if the connection failed
+ */
+uint8_t *transport_tx_slot(void);
+
+/**
+ * @brief Send the batch encoded into the slot returned by the last #transport_tx_slot().
+ *
+ * @return false if the connection failed
+ */
+bool transport_send_slot(size_t len);
+
+/**
+ * @brief Get the cycles spent transmitting batches and the bytes written in them since boot.
+ *
+ * @details Differences of two readings give the cycles per byte of the backend, the counters wrap around.
+ * A span during which the task was migrated to the other core is left out of both counters.
+ *
+ * @param cycles - destination of the cycle count
+ * @param bytes - destination of the byte count
+ */
+void transport_tx_cost(uint32_t *cycles, uint32_t *bytes);
+
+#endif //__TCP_TRANSPORT_H__
@@ -0,0 +1,167 @@
+#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#define CSV_FORMAT(sensor, field, type, format, header, conversion) ", " format
+#define CSV_AGGREGATE_FORMAT(sensor, field, type, format, header, conversion) \
+    ", " format ", " format ", " format ", " format
+
+//windows extended because they could not be queued, written by the measurements task only
+static volatile uint32_t extended_windows = 0;
+
+void aggregator_reset(aggregator *agg)
+{
+    assert(agg != NULL);
+    agg->level = 0;
+    agg->calm_windows = 0;
+    agg->window.count = 0;
+}
+
+static inline uint32_t window_len(uint8_t level)
+{
+    return 1u << (2 * level);
+}
+
+static void window_add(telemetry_record *window, const measurements_data *data)
+{
+    if(window->count == 0)
+    {
+        window->min = *data;
+        window->max = *data;
+        window->mean = *data;
+    }
+    else
+    {
+#define WINDOW_ADD_FIELD(sensor, field, type, format, header, conversion) \
+        if(data->field < window->min.field) window->min.field = data->field; \
+        if(data->field > window->max.field) window->max.field = data->field; \
+        window->mean.field += data->field;
+        MEASUREMENT_FIELDS(WINDOW_ADD_FIELD)
+        window->max.time_us = data->time_us;
+    }
+    window->last = *data;
+    window->count++;
+}
+
+bool aggregator_push(aggregator *agg, const measurements_data *data,
+                     uint32_t spaces_available, uint32_t queue_len,
+                     telemetry_record *record)
+{
+    assert(agg != NULL && data != NULL && record != NULL);
+    window_add(&agg->window, data);
+    if(agg->window.count < window_len(agg->level))
+    {
+        return false;
+    }
+    //the window is complete, adapt the level to the fill of the queue
+    uint8_t window_level = agg->level;
+    if(spaces_available <= queue_len / 4)
+    {
+        agg->calm_windows = 0;
+        if(agg->level < AGGREGATION_MAX_LEVEL)
+        {
+            agg->level++;
+        }
+    }
+    else if(spaces_available >= queue_len * 3 / 4 && agg->level > 0 &&
+            ++agg->calm_windows >= AGGREGATION_CALM_WINDOWS)
+    {
+        agg->calm_windows = 0;
+        agg->level--;
+    }
+    //a window which can not be queued is extended, its samples stay in the statistics
+    if(spaces_available == 0)
+    {
+        extended_windows++;
+        return false;
+    }
+    *record = agg->window;
+    record->level = window_level;
+    if(record->count > 1)
+    {
+#define WINDOW_MEAN_FIELD(sensor, field, type, format, header, conversion) \
+        record->mean.field /= record->count;
+        MEASUREMENT_FIELDS(WINDOW_MEAN_FIELD)
+    }
+    return true;
+}
+
+void aggregator_queued(aggregator *agg, bool queued)
+{
+    assert(agg != NULL);
+    if(queued)
+    {
+        agg->window.count = 0;
+    }
+    else
+    {
+        //the queue filled up since its free space was read, the window is kept open
+        extended_windows++;
+    }
+}
+
+uint32_t aggregator_extended_windows(void)
+{
+    return extended_windows;
+}
+
+size_t telemetry_to_csv(char *buffer, const telemetry_record *record)
+{
+    assert(buffer != NULL && record != NULL);
+    int len;
+    if(record->count == 1)
+    {
+        const measurements_data *data = &record->last;
+#define CSV_ARGUMENT(sensor, field, type, format, header, conversion) , data->field
+        len = snprintf(buffer, TELEMETRY_CSV_MAX_LEN,
+                       "%"PRIu64", %u, %"PRIu32 MEASUREMENT_FIELDS(CSV_FORMAT) "\n",
+                       data->time_us, record->level, record->count MEASUREMENT_FIELDS(CSV_ARGUMENT));
+    }
+    else
+    {
+#define CSV_AGGREGATE_ARGUMENTS(sensor, field, type, format, header, conversion) \
+        , record->min.field, record->max.field, record->mean.field, record->last.field
+        len = snprintf(buffer, TELEMETRY_CSV_MAX_LEN,
+                       "%"PRIu64", %u, %"PRIu32 MEASUREMENT_FIELDS(CSV_AGGREGATE_FORMAT) "\n",
+                       record->last.time_us, record->level, record->count MEASUREMENT_FIELDS(CSV_AGGREGATE_ARGUMENTS));
+    }
+    return len < TELEMETRY_CSV_MAX_LEN ? len : TELEMETRY_CSV_MAX_LEN - 1;
+}
+
+//the esp32 is little endian, values are copied as they are laid out in memory
+#define BIN_PUT(out, value)                  \
+    do {                                     \
+        memcpy(out, &(value), sizeof(value)); \
+        out += sizeof(value);                \
+    } while(0)
+
+size_t telemetry_to_bin(uint8_t *buffer, const telemetry_record *record)
+{
+    assert(buffer != NULL && record != NULL);
+    uint8_t *out = buffer;
+    *out++ = BIN_FRAME_SYNC;
+    if(record->count == 1)
+    {
+        *out++ = BIN_RECORD_MEASUREMENTS;
+        *out++ = record->level;
+        BIN_PUT(out, record->last.time_us);
+#define BIN_FIELD(sensor, field, type, format, header, conversion) BIN_PUT(out, record->last.field);
+        MEASUREMENT_FIELDS(BIN_FIELD)
+    }
+    else
+    {
+        *out++ = BIN_RECORD_AGGREGATE;
+        *out++ = record->level;
+        BIN_PUT(out, record->count);
+        BIN_PUT(out, record->min.time_us);
+        BIN_PUT(out, record->max.time_us);
+#define BIN_AGGREGATE_FIELD(sensor, field, type, format, header, conversion) \
+        BIN_PUT(out, record->min.field);                                     \
+        BIN_PUT(out, record->max.field);                                     \
+        BIN_PUT(out, record->mean.field);                                    \
+        BIN_PUT(out, record->last.field);
+        MEASUREMENT_FIELDS(BIN_AGGREGATE_FIELD)
+    }
+    return out - buffer;
+}
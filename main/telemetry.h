@@ -0,0 +1,162 @@
+/** @file telemetry.h
+ * @author Czira Bence (czirabence@gmail.com)
+ * 
+ * @brief Records of the telemetry stream, their encodings, and the adaptive aggregation
+ * applied when the link falls behind.
+ * 
+ * @version 0.1
+ * @date 2023-06-12
+ * 
+ * @details Every sample taken by measurements_task is passed to an #aggregator together with
+ * the free space of the transmit queue. While the link keeps up, every sample is emitted as a raw
+ * record of aggregation level 0. When the queue fills up, the level is raised and samples are
+ * gathered into windows of 4^level samples, each emitted as one record holding the min, max,
+ * mean and last value of every field and the number of samples it covers. Once the queue has
+ * drained for #AGGREGATION_CALM_WINDOWS consecutive windows the level is lowered again. A window
+ * which can not be queued is extended instead of dropped, so no sample is lost from the statistics.
+ * The window is only closed once the queue has accepted its record, see #aggregator_queued(), and
+ * the extended windows are counted in the <b>#txstat</b> lines of the tcp server.
+ * 
+ * Every record is tagged with its level and sample count. Fields are the readings of
+ * #SENSOR_FIELDS followed by the estimates of #DERIVED_FIELDS, see #MEASUREMENT_FIELDS.
+ * - <b>csv</b>: rows start with time, level and count. Rows of a single sample continue with the
+ *   fields of #TELEMETRY_CSV_HEADER, rows of more samples with the statistics of
+ *   #TELEMETRY_AGGREGATE_CSV_HEADER, which is sent as a '#' line after the header.
+ * - <b>bin</b>: frames start with #BIN_FRAME_SYNC, the record type and the level. Raw frames
+ *   continue with the time and the fields, aggregate frames with the count, the time of the first
+ *   and last sample and min, max, mean, last of every field. Values are little endian.
+ */
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sensors.h"
+
+/** @def AGGREGATION_MAX_LEVEL
+ * @brief highest aggregation level, windows of 4^level samples
+ */
+#define AGGREGATION_MAX_LEVEL 3
+/** @def AGGREGATION_CALM_WINDOWS
+ * @brief windows completed with a drained queue before the level is lowered
+ */
+#define AGGREGATION_CALM_WINDOWS 2
+
+/** @def CSV_FIELD_MAX_LEN
+ * @brief character budget of a single formatted field in a csv row
+ */
+#define CSV_FIELD_MAX_LEN 16
+/** @def TELEMETRY_CSV_MAX_LEN
+ * @brief An aggregate csv row (time, level, count + 4 statistics of every field + "\\n\\0") needs to fit in.
+ */
+#define TELEMETRY_CSV_MAX_LEN (20 + 2 * (2 + 10) + 4 * MEASUREMENT_FIELD_COUNT * (2 + CSV_FIELD_MAX_LEN) + 2)
+
+/** @def BIN_FRAME_SYNC
+ * @brief first byte of every binary frame
+ */
+#define BIN_FRAME_SYNC 0xA5
+/** @def BIN_RECORD_MEASUREMENTS
+ * @brief binary frame type of a single sample
+ */
+#define BIN_RECORD_MEASUREMENTS 0x01
+/** @def BIN_RECORD_AGGREGATE
+ * @brief binary frame type of an aggregated window
+ */
+#define BIN_RECORD_AGGREGATE 0x02
+/** @def TELEMETRY_BIN_MAX_LEN
+ * @brief size of the largest binary frame, an aggregate frame
+ */
+#define BIN_FIELD_SIZE(sensor, field, type, format, header, conversion) + sizeof(type)
+#define TELEMETRY_BIN_MAX_LEN (3 + sizeof(uint32_t) + 2 * sizeof(uint64_t) + 4 * (0 MEASUREMENT_FIELDS(BIN_FIELD_SIZE)))
+
+/** @def TELEMETRY_CSV_HEADER
+ * @brief csv header of single sample rows
+ */
+#define CSV_HEADER_COLUMN(sensor, field, type, format, header, conversion) ", " header
+#define TELEMETRY_CSV_HEADER "time[us], level, count" MEASUREMENT_FIELDS(CSV_HEADER_COLUMN) "\n"
+/** @def TELEMETRY_AGGREGATE_CSV_HEADER
+ * @brief csv header of aggregate rows, time is the time of the last sample
+ */
+#define CSV_AGGREGATE_HEADER_COLUMNS(sensor, field, type, format, header, conversion) \
+    ", " header " min, " header " max, " header " mean, " header " last"
+#define TELEMETRY_AGGREGATE_CSV_HEADER "#time[us], level, count" MEASUREMENT_FIELDS(CSV_AGGREGATE_HEADER_COLUMNS) "\n"
+
+/**
+ * @brief A record of the telemetry stream: a single sample or the statistics of a window.
+ * 
+ * @details Time of <b>min</b> and <b>max</b> hold the time of the first and last sample,
+ * only <b>last</b> is valid if <b>count</b> is 1.
+ */
+typedef struct telemetry_record{
+    uint8_t level;
+    uint32_t count;
+    measurements_data min;
+    measurements_data max;
+    measurements_data mean;
+    measurements_data last;
+} telemetry_record;
+
+/**
+ * @brief State of the adaptive aggregation.
+ */
+typedef struct aggregator{
+    uint8_t level;
+    uint32_t calm_windows;
+    telemetry_record window;
+} aggregator;
+
+/**
+ * @brief Restart aggregation at level 0 with an empty window.
+ */
+void aggregator_reset(aggregator *agg);
+
+/**
+ * @brief Add a sample to the current window and decide whether a record is ready to be queued.
+ * 
+ * @param agg - aggregation state
+ * @param data - the new sample
+ * @param spaces_available - free places in the transmit queue
+ * @param queue_len - length of the transmit queue
+ * @param record - destination of the completed record
+ * @return true if <b>record</b> was written and should be queued, the window stays open until
+ * #aggregator_queued() is called
+ */
+bool aggregator_push(aggregator *agg, const measurements_data *data,
+                     uint32_t spaces_available, uint32_t queue_len,
+                     telemetry_record *record);
+
+/**
+ * @brief Close the window of the record returned by #aggregator_push() once it was queued,
+ * or keep it open and extend it with the following samples if the queue was full.
+ *
+ * @param agg - aggregation state
+ * @param queued - result of queueing the record
+ */
+void aggregator_queued(aggregator *agg, bool queued);
+
+/**
+ * @brief Get the number of windows extended because their record could not be queued,
+ * counted since boot.
+ */
+uint32_t aggregator_extended_windows(void);
+
+/**
+ * @brief Convert a record into a csv row, write result into <b>buffer</b>.
+ * 
+ * @param buffer - char array destination of at least #TELEMETRY_CSV_MAX_LEN bytes
+ * @param record - a telemetry_record struct
+ * @return length of the csv row without the terminating null character
+ */
+size_t telemetry_to_csv(char *buffer, const telemetry_record *record);
+
+/**
+ * @brief Convert a record into a binary frame, write result into <b>buffer</b>.
+ * 
+ * @param buffer - destination of at least #TELEMETRY_BIN_MAX_LEN bytes
+ * @param record - a telemetry_record struct
+ * @return length of the frame
+ */
+size_t telemetry_to_bin(uint8_t *buffer, const telemetry_record *record);
+
+#endif //__TELEMETRY_H__
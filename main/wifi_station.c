@@ -7,14 +7,18 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include "wifi_station.h"
+#include "boot_time.h"
 #include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "lwip/err.h"
@@ -27,7 +31,7 @@
 */
 #define EXAMPLE_ESP_WIFI_SSID      CONFIG_ESP_WIFI_SSID
 #define EXAMPLE_ESP_WIFI_PASS      CONFIG_ESP_WIFI_PASSWORD
-#define EXAMPLE_ESP_MAXIMUM_RETRY  CONFIG_ESP_MAXIMUM_RETRY
+#define EXAMPLE_ESP_RECONNECT_MAX_MS CONFIG_ESP_WIFI_RECONNECT_MAX_MS
 
 #if CONFIG_ESP_WIFI_AUTH_OPEN
 #define ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_OPEN
@@ -48,19 +52,43 @@
 #endif
 
 
-/* FreeRTOS event group to signal when we are connected*/
-static EventGroupHandle_t s_wifi_event_group;
-
-/* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
+//first reconnect attempt after a disconnect, the delay doubles up to EXAMPLE_ESP_RECONNECT_MAX_MS
+#define WIFI_RECONNECT_MIN_MS 100
 
 static const char *TAG = "wifi station";
 
-static int s_retry_num = 0;
+/* reconnect attempts are scheduled on a one shot timer instead of being made from the
+ * event handler, so a missing AP is retried forever without flooding the driver */
+static esp_timer_handle_t s_reconnect_timer;
+static uint32_t s_reconnect_ms = WIFI_RECONNECT_MIN_MS;
+static uint32_t s_retry_num = 0;
+/* set when the timer could not be started, no event would bring the next attempt,
+ * wifi_sta_retry() makes it from the loop of the tcp server */
+static volatile bool s_retry_pending = false;
+
 
+static void schedule_reconnect(void)
+{
+    s_retry_num++;
+    //a timer still armed is restarted, so every doubling of the backoff belongs to an attempt
+    esp_timer_stop(s_reconnect_timer);
+    esp_err_t err = esp_timer_start_once(s_reconnect_timer, (uint64_t)s_reconnect_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "reconnect could not be scheduled: %s, retried by the tcp server", esp_err_to_name(err));
+        s_retry_pending = true;
+        return;
+    }
+    ESP_LOGI(TAG, "connect to the AP fail, retry %"PRIu32" in %"PRIu32" ms", s_retry_num, s_reconnect_ms);
+    s_reconnect_ms = MIN(2 * s_reconnect_ms, EXAMPLE_ESP_RECONNECT_MAX_MS);
+}
+
+static void reconnect(void *arg)
+{
+    //an attempt which could not be started raises no disconnect event, the next one is scheduled here
+    if (esp_wifi_connect() != ESP_OK) {
+        schedule_reconnect();
+    }
+}
 
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
@@ -68,45 +96,55 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "retry to connect to the AP");
-        } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
-        }
-        ESP_LOGI(TAG,"connect to the AP fail");
+        schedule_reconnect();
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "got ip:" IPSTR " after %"PRIu32" retries", IP2STR(&event->ip_info.ip), s_retry_num);
+        boot_time_mark(BOOT_PHASE_wifi_ip);
         s_retry_num = 0;
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        s_reconnect_ms = WIFI_RECONNECT_MIN_MS;
+        s_retry_pending = false;
     }
 }
 
-void wifi_init_sta(void)
+void wifi_sta_retry(void)
 {
-    s_wifi_event_group = xEventGroupCreate();
+    if (s_retry_pending) {
+        //cleared first, an attempt failing again sets it for the next call
+        s_retry_pending = false;
+        reconnect(NULL);
+    }
+}
+
+esp_err_t wifi_init_sta(void)
+{
+    /* the station is brought up while the car is driving, errors are returned
+     * instead of aborting, so a failing network never reboots the car */
+    const esp_timer_create_args_t reconnect_timer_args = {
+        .callback = reconnect,
+        .name = "wifi reconnect",
+    };
+    ESP_RETURN_ON_ERROR(esp_timer_create(&reconnect_timer_args, &s_reconnect_timer), TAG, "reconnect timer");
 
-    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_RETURN_ON_ERROR(esp_netif_init(), TAG, "netif init");
 
-    esp_netif_create_default_wifi_sta();
+    ESP_RETURN_ON_FALSE(esp_netif_create_default_wifi_sta() != NULL, ESP_ERR_NO_MEM, TAG, "station netif");
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_RETURN_ON_ERROR(esp_wifi_init(&cfg), TAG, "wifi init");
 
     esp_event_handler_instance_t instance_any_id;
     esp_event_handler_instance_t instance_got_ip;
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                                                        ESP_EVENT_ANY_ID,
-                                                        &event_handler,
-                                                        NULL,
-                                                        &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-                                                        IP_EVENT_STA_GOT_IP,
-                                                        &event_handler,
-                                                        NULL,
-                                                        &instance_got_ip));
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(WIFI_EVENT,
+                                                            ESP_EVENT_ANY_ID,
+                                                            &event_handler,
+                                                            NULL,
+                                                            &instance_any_id), TAG, "wifi event handler");
+    ESP_RETURN_ON_ERROR(esp_event_handler_instance_register(IP_EVENT,
+                                                            IP_EVENT_STA_GOT_IP,
+                                                            &event_handler,
+                                                            NULL,
+                                                            &instance_got_ip), TAG, "ip event handler");
 
     wifi_config_t wifi_config = {
         .sta = {
@@ -121,41 +159,25 @@ void wifi_init_sta(void)
             .sae_pwe_h2e = WPA3_SAE_PWE_BOTH,
         },
     };
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
-    ESP_ERROR_CHECK(esp_wifi_start() );
-
-    ESP_LOGI(TAG, "wifi_init_sta finished.");
-
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-            pdFALSE,
-            pdFALSE,
-            portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "connected to ap SSID:%s password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    } else {
-        ESP_LOGE(TAG, "UNEXPECTED EVENT");
-    }
+    ESP_RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA), TAG, "wifi mode");
+    ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &wifi_config), TAG, "wifi config");
+    ESP_RETURN_ON_ERROR(esp_wifi_start(), TAG, "wifi start");
+
+    boot_time_mark(BOOT_PHASE_wifi_start);
+
+    ESP_LOGI(TAG, "wifi_init_sta finished, connecting to SSID:%s in the background", EXAMPLE_ESP_WIFI_SSID);
+    return ESP_OK;
 }
 
-void nvs_init(void)
+esp_err_t nvs_init(void)
 {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-      ESP_ERROR_CHECK(nvs_flash_erase());
+      ESP_RETURN_ON_ERROR(nvs_flash_erase(), TAG, "nvs erase");
       ret = nvs_flash_init();
     }
-    ESP_ERROR_CHECK(ret);
+    ESP_RETURN_ON_ERROR(ret, TAG, "nvs init");
 
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
+    return ESP_OK;
 }
@@ -2,8 +2,11 @@
  * @author Czira Bence (czirabence@gmail.com)
  * 
  * @brief This is a modified version of esp-idf/examples/wifi/getting_started/station.
- * Set <b>CONFIG_ESP_WIFI_SSID, CONFIG_ESP_WIFI_PASSWORD, CONFIG_ESP_MAXIMUM_RETRY</b>
+ * Set <b>CONFIG_ESP_WIFI_SSID, CONFIG_ESP_WIFI_PASSWORD, CONFIG_ESP_WIFI_RECONNECT_MAX_MS</b>
  * and <b>ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD</b> under <b>Wifi Configuration</b> submenu in project configuration menu.
+ * The station never gives up: after a disconnect it reconnects with a backoff doubling from 100 ms
+ * up to <b>CONFIG_ESP_WIFI_RECONNECT_MAX_MS</b>, which is restarted once an IP address is obtained.
+ * An attempt whose timer could not be started is made by #wifi_sta_retry() instead.
  * 
  * @version 0.1
  * @date 2023-06-12 
@@ -11,16 +14,29 @@
 #ifndef WIFI_STA_H
 #define WIFI_STA_H
 
+#include "esp_err.h"
+
 /**
  * @brief initialize and start wifi station. Esp event loop must be created 
  * via esp_event_loop_create_default() before this function is called.
+ * Returns once the station is started, the connection is made in the background.
+ * 
+ * @return ESP_OK on success, the error of the failing step otherwise, which is logged
+*/
+esp_err_t wifi_init_sta(void);
+
+/**
+ * @brief Make the reconnect attempt whose timer could not be started, if there is one.
+ * Called periodically by the tcp server while it waits for a client, so the station keeps
+ * reconnecting even if the timer fails.
 */
-void wifi_init_sta(void);
+void wifi_sta_retry(void);
 
 /**
- * @brief Initialise nvs. 
+ * @brief Initialise nvs, erase it first if it is full or of an other version.
  * 
+ * @return ESP_OK on success, the error of nvs_flash_init() or nvs_flash_erase() otherwise, which is logged
  */
-void nvs_init(void);
+esp_err_t nvs_init(void);
 
 #endif //__WIFI_STA_H__
\ No newline at end of file
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include "analytics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+
+//independent accumulators of the reductions, filled by the SIMD lanes of the host
+#define ANALYTICS_LANES 8
+
+static char *trim(char *s)
+{
+    while(isspace((unsigned char)*s))
+    {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = '\0';
+    return s;
+}
+
+bool analytics_table_load(const char *path, analytics_table *table)
+{
+    memset(table, 0, sizeof(*table));
+    FILE *file = fopen(path, "r");
+    if(file == NULL)
+    {
+        return false;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t capacity = 0;
+    bool ok = true;
+    while(ok && getline(&line, &line_size, file) > 0)
+    {
+        char *content = trim(line);
+        if(*content == '\0' || *content == '#')
+        {
+            continue;
+        }
+        if(table->columns == 0)
+        {
+            for(char *name = strtok(content, ","); name != NULL && table->columns < ANALYTICS_MAX_COLUMNS;
+                name = strtok(NULL, ","))
+            {
+                table->names[table->columns++] = strdup(trim(name));
+            }
+            continue;
+        }
+        if(table->rows == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 4096;
+            for(size_t c = 0; c < table->columns && ok; c++)
+            {
+                double *grown = realloc(table->data[c], capacity * sizeof(double));
+                ok = grown != NULL;
+                table->data[c] = ok ? grown : table->data[c];
+            }
+        }
+        char *cursor = content;
+        for(size_t c = 0; c < table->columns && ok; c++)
+        {
+            char *end = NULL;
+            table->data[c][table->rows] = strtod(cursor, &end);
+            ok = end != cursor && (*end == ',' || *end == '\0' || isspace((unsigned char)*end));
+            cursor = strchr(end, ',');
+            cursor = cursor != NULL ? cursor + 1 : end;
+        }
+        table->rows++;
+    }
+    free(line);
+    fclose(file);
+    if(!ok || table->columns == 0)
+    {
+        analytics_table_free(table);
+        return false;
+    }
+    return true;
+}
+
+void analytics_table_free(analytics_table *table)
+{
+    for(size_t c = 0; c < table->columns; c++)
+    {
+        free(table->names[c]);
+        free(table->data[c]);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+double *analytics_table_column(const analytics_table *table, const char *name)
+{
+    for(size_t c = 0; c < table->columns; c++)
+    {
+        if(strcmp(table->names[c], name) == 0)
+        {
+            return table->data[c];
+        }
+    }
+    return NULL;
+}
+
+void analytics_diff(const double *restrict t, const double *restrict x, double *restrict dxdt,
+                    size_t n, size_t begin, size_t end)
+{
+    if(begin == 0 && end > 0)
+    {
+        dxdt[0] = (x[1] - x[0]) / (t[1] - t[0]);
+        begin = 1;
+    }
+    if(end == n && begin < n)
+    {
+        dxdt[n - 1] = (x[n - 1] - x[n - 2]) / (t[n - 1] - t[n - 2]);
+        end = n - 1;
+    }
+    for(size_t i = begin; i < end; i++)
+    {
+        dxdt[i] = (x[i + 1] - x[i - 1]) / (t[i + 1] - t[i - 1]);
+    }
+}
+
+void analytics_fir(const double *restrict x, double *restrict y, size_t n,
+                   const double *restrict taps, size_t half, size_t begin, size_t end)
+{
+    //rows whose taps reach over the ends use the end values
+    size_t inner_begin = begin > half ? begin : (half < end ? half : end);
+    size_t inner_end = n > half && end > n - half ? n - half : end;
+    if(inner_end < inner_begin)
+    {
+        inner_end = inner_begin;
+    }
+    for(size_t i = begin; i < end; i++)
+    {
+        if(i >= inner_begin && i < inner_end)
+        {
+            i = inner_end - 1;
+            continue;
+        }
+        double sum = 0;
+        for(size_t k = 0; k <= 2 * half; k++)
+        {
+            long j = (long)i + (long)k - (long)half;
+            j = j < 0 ? 0 : (j >= (long)n ? (long)n - 1 : j);
+            sum += taps[k] * x[j];
+        }
+        y[i] = sum;
+    }
+    //tap by tap over the rows, the inner loop has no dependency between rows
+    for(size_t i = inner_begin; i < inner_end; i++)
+    {
+        y[i] = 0;
+    }
+    for(size_t k = 0; k <= 2 * half; k++)
+    {
+        const double tap = taps[k];
+        for(size_t i = inner_begin; i < inner_end; i++)
+        {
+            y[i] += tap * x[i + k - half];
+        }
+    }
+}
+
+void analytics_boxcar(double *taps, size_t half)
+{
+    for(size_t k = 0; k <= 2 * half; k++)
+    {
+        taps[k] = 1.0 / (2 * half + 1);
+    }
+}
+
+void analytics_resample(const double *restrict t, const double *restrict x, size_t n,
+                        double t0, double dt, double *restrict out, size_t begin, size_t end)
+{
+    if(begin >= end)
+    {
+        return;
+    }
+    //interval of the first output row, the following rows advance monotonically
+    size_t lo = 0;
+    size_t hi = n - 1;
+    double first = t0 + begin * dt;
+    while(hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if(t[mid] <= first)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    size_t j = lo;
+    for(size_t i = begin; i < end; i++)
+    {
+        double time = t0 + i * dt;
+        while(j + 2 < n && t[j + 1] <= time)
+        {
+            j++;
+        }
+        if(time <= t[0])
+        {
+            out[i] = x[0];
+        }
+        else if(time >= t[n - 1])
+        {
+            out[i] = x[n - 1];
+        }
+        else
+        {
+            double w = (time - t[j]) / (t[j + 1] - t[j]);
+            out[i] = x[j] + w * (x[j + 1] - x[j]);
+        }
+    }
+}
+
+double analytics_xcorr(const double *restrict x, const double *restrict y, size_t n, long lag)
+{
+    size_t first = lag < 0 ? (size_t)-lag : 0;
+    size_t last = lag > 0 ? (lag < (long)n ? n - lag : 0) : n;
+    if(last <= first + 1)
+    {
+        return 0;
+    }
+    double sx[ANALYTICS_LANES] = {0}, sy[ANALYTICS_LANES] = {0};
+    double sxx[ANALYTICS_LANES] = {0}, syy[ANALYTICS_LANES] = {0}, sxy[ANALYTICS_LANES] = {0};
+    size_t i = first;
+    for(; i + ANALYTICS_LANES <= last; i += ANALYTICS_LANES)
+    {
+        for(size_t l = 0; l < ANALYTICS_LANES; l++)
+        {
+            double a = x[i + l];
+            double b = y[(long)(i + l) + lag];
+            sx[l] += a;
+            sy[l] += b;
+            sxx[l] += a * a;
+            syy[l] += b * b;
+            sxy[l] += a * b;
+        }
+    }
+    for(size_t l = 0; i < last; i++, l++)
+    {
+        double a = x[i];
+        double b = y[(long)i + lag];
+        sx[l] += a;
+        sy[l] += b;
+        sxx[l] += a * a;
+        syy[l] += b * b;
+        sxy[l] += a * b;
+    }
+    for(size_t l = 1; l < ANALYTICS_LANES; l++)
+    {
+        sx[0] += sx[l];
+        sy[0] += sy[l];
+        sxx[0] += sxx[l];
+        syy[0] += syy[l];
+        sxy[0] += sxy[l];
+    }
+    double m = last - first;
+    double cov = sxy[0] - sx[0] * sy[0] / m;
+    double var_x = sxx[0] - sx[0] * sx[0] / m;
+    double var_y = syy[0] - sy[0] * sy[0] / m;
+    if(var_x <= 0 || var_y <= 0)
+    {
+        return 0;
+    }
+    return cov / sqrt(var_x * var_y);
+}
+
+typedef struct xcorr_context{
+    const double *x;
+    const double *y;
+    size_t n;
+    long max_lag;
+    double *correlations;
+} xcorr_context;
+
+static void xcorr_kernel(size_t begin, size_t end, void *context)
+{
+    xcorr_context *c = context;
+    for(size_t i = begin; i < end; i++)
+    {
+        c->correlations[i] = analytics_xcorr(c->x, c->y, c->n, (long)i - c->max_lag);
+    }
+}
+
+long analytics_xcorr_lag(const double *x, const double *y, size_t n, long max_lag,
+                         size_t threads, double *correlation)
+{
+    size_t lags = 2 * max_lag + 1;
+    xcorr_context context = {
+        .x = x,
+        .y = y,
+        .n = n,
+        .max_lag = max_lag,
+        .correlations = malloc(lags * sizeof(double)),
+    };
+    if(context.correlations == NULL)
+    {
+        return 0;
+    }
+    analytics_parallel(lags, threads, xcorr_kernel, &context);
+    size_t best = max_lag;
+    for(size_t i = 0; i < lags; i++)
+    {
+        if(context.correlations[i] > context.correlations[best])
+        {
+            best = i;
+        }
+    }
+    if(correlation != NULL)
+    {
+        *correlation = context.correlations[best];
+    }
+    free(context.correlations);
+    return (long)best - max_lag;
+}
+
+void analytics_ttc(const double *restrict distance, const double *restrict closing_speed,
+                   double *restrict ttc, size_t begin, size_t end)
+{
+    for(size_t i = begin; i < end; i++)
+    {
+        ttc[i] = closing_speed[i] > 0 ? distance[i] / closing_speed[i] : INFINITY;
+    }
+}
+
+size_t analytics_detect_events(const double *x, size_t n, double threshold, size_t min_len,
+                               analytics_event *events, size_t max_events)
+{
+    size_t count = 0;
+    size_t i = 0;
+    while(i < n)
+    {
+        if(!(x[i] < threshold))
+        {
+            i++;
+            continue;
+        }
+        size_t begin = i;
+        double peak = x[i];
+        while(i < n && x[i] < threshold)
+        {
+            peak = x[i] < peak ? x[i] : peak;
+            i++;
+        }
+        if(i - begin >= min_len)
+        {
+            if(count < max_events)
+            {
+                events[count] = (analytics_event){.begin = begin, .end = i, .peak = peak};
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+typedef struct worker{
+    pthread_t thread;
+    size_t begin;
+    size_t end;
+    void (*kernel)(size_t begin, size_t end, void *context);
+    void *context;
+} worker;
+
+static void *worker_run(void *arg)
+{
+    worker *w = arg;
+    w->kernel(w->begin, w->end, w->context);
+    return NULL;
+}
+
+void analytics_parallel(size_t n, size_t threads,
+                        void (*kernel)(size_t begin, size_t end, void *context), void *context)
+{
+    if(threads < 1)
+    {
+        threads = 1;
+    }
+    if(threads > ANALYTICS_MAX_THREADS)
+    {
+        threads = ANALYTICS_MAX_THREADS;
+    }
+    if(threads > n)
+    {
+        threads = n > 0 ? n : 1;
+    }
+    worker workers[ANALYTICS_MAX_THREADS];
+    size_t started = 0;
+    for(size_t i = 0; i < threads; i++)
+    {
+        workers[i] = (worker){
+            .begin = n * i / threads,
+            .end = n * (i + 1) / threads,
+            .kernel = kernel,
+            .context = context,
+        };
+    }
+    //the calling thread takes the first range, a worker that can not be started is run inline
+    for(size_t i = 1; i < threads; i++)
+    {
+        if(pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0)
+        {
+            worker_run(&workers[i]);
+            workers[i].kernel = NULL;
+        }
+        started++;
+    }
+    worker_run(&workers[0]);
+    for(size_t i = 1; i <= started; i++)
+    {
+        if(workers[i].kernel != NULL)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+}
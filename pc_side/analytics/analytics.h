@@ -0,0 +1,163 @@
+/** @file analytics.h
+ * @author Czira Bence (czirabence@gmail.com)
+ *
+ * @brief Column oriented analytics of recorded telemetry, run on the host after a session.
+ *
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @details Logs written by telemetry_ingest.py are loaded into whole columns of doubles with
+ * #analytics_table_load(), and derived signals are computed by kernels working on entire
+ * columns instead of rows:
+ * - #analytics_diff() - time derivative on the sampled, possibly non-uniform grid
+ * - #analytics_fir() - symmetric FIR filter, e.g. the moving average of #analytics_boxcar()
+ * - #analytics_resample() - linear interpolation onto a uniform grid
+ * - #analytics_xcorr() - normalised cross-correlation at a lag, the latency between two
+ *   signals is the lag maximising it, see #analytics_xcorr_lag()
+ * - #analytics_ttc() - time to collision from distance and closing speed
+ * - #analytics_detect_events() - intervals where a signal stays below a threshold
+ *
+ * Kernels compute the output rows [begin, end) of a column and read their inputs only, so
+ * any split of the rows gives the same result. #analytics_parallel() splits a kernel over
+ * worker threads this way, multi-hour and multi-car logs scale with the number of cores. The
+ * inner loops are plain loops over restrict qualified arrays without loop carried
+ * dependencies, compilers vectorise them at -O3, with -march=native using the widest SIMD
+ * unit of the host.
+ *
+ * build: cc -O3 -march=native -I. analytics_cli.c analytics.c -lpthread -lm -o analytics
+ *        cc -O3 -march=native -I. analytics_bench.c analytics.c -lpthread -lm -o analytics_bench
+ */
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** @def ANALYTICS_MAX_COLUMNS
+ * @brief largest number of columns of a loaded table
+ */
+#define ANALYTICS_MAX_COLUMNS 64
+/** @def ANALYTICS_MAX_THREADS
+ * @brief largest number of worker threads of #analytics_parallel()
+ */
+#define ANALYTICS_MAX_THREADS 256
+
+/**
+ * @brief Columns of a csv log, every column holds <b>rows</b> values.
+ */
+typedef struct analytics_table{
+    size_t rows;
+    size_t columns;
+    char *names[ANALYTICS_MAX_COLUMNS];
+    double *data[ANALYTICS_MAX_COLUMNS];
+} analytics_table;
+
+/**
+ * @brief Interval of rows [begin, end) found by #analytics_detect_events().
+ */
+typedef struct analytics_event{
+    size_t begin;
+    size_t end;
+    //extreme value of the signal inside the interval
+    double peak;
+} analytics_event;
+
+/**
+ * @brief Load a csv log with a header line into columns, lines starting with '#' are skipped.
+ *
+ * @return true on success, false if the file can not be read or a row is malformed
+ */
+bool analytics_table_load(const char *path, analytics_table *table);
+
+/**
+ * @brief Free the columns of a table.
+ */
+void analytics_table_free(analytics_table *table);
+
+/**
+ * @brief Find a column by its header name, leading and trailing spaces are ignored.
+ *
+ * @return the column, NULL if there is no such column
+ */
+double *analytics_table_column(const analytics_table *table, const char *name);
+
+/**
+ * @brief Derivative of <b>x</b> by <b>t</b>, central differences inside, one sided at the ends.
+ *
+ * @param t - sample times, strictly increasing
+ * @param x - signal
+ * @param dxdt - destination
+ * @param n - number of samples, at least 2
+ * @param begin - first row computed
+ * @param end - one past the last row computed
+ */
+void analytics_diff(const double *restrict t, const double *restrict x, double *restrict dxdt,
+                    size_t n, size_t begin, size_t end);
+
+/**
+ * @brief Symmetric FIR filter with <b>2 * half + 1</b> taps, the signal is extended with its
+ * end values.
+ *
+ * @param taps - the <b>2 * half + 1</b> coefficients
+ */
+void analytics_fir(const double *restrict x, double *restrict y, size_t n,
+                   const double *restrict taps, size_t half, size_t begin, size_t end);
+
+/**
+ * @brief Fill <b>2 * half + 1</b> taps of a moving average.
+ */
+void analytics_boxcar(double *taps, size_t half);
+
+/**
+ * @brief Linear interpolation of <b>x</b> sampled at <b>t</b> at the times t0 + i * dt,
+ * constant outside the sampled range.
+ *
+ * @param n - number of input samples
+ * @param out - destination, rows [begin, end) of the uniform grid
+ */
+void analytics_resample(const double *restrict t, const double *restrict x, size_t n,
+                        double t0, double dt, double *restrict out, size_t begin, size_t end);
+
+/**
+ * @brief Normalised cross-correlation of <b>x</b> and <b>y</b> shifted by <b>lag</b> samples,
+ * the correlation coefficient of x[i] and y[i + lag].
+ *
+ * @return coefficient in [-1, 1], 0 if either signal is constant over the overlap
+ */
+double analytics_xcorr(const double *restrict x, const double *restrict y, size_t n, long lag);
+
+/**
+ * @brief Lag in [-max_lag, max_lag] maximising #analytics_xcorr(), lags are evaluated by
+ * <b>threads</b> workers.
+ *
+ * @param correlation - destination of the maximal coefficient, may be NULL
+ * @return lag [samples], positive if <b>y</b> follows <b>x</b>
+ */
+long analytics_xcorr_lag(const double *x, const double *y, size_t n, long max_lag,
+                         size_t threads, double *correlation);
+
+/**
+ * @brief Time to collision, distance over closing speed, INFINITY while the gap is not closing.
+ */
+void analytics_ttc(const double *restrict distance, const double *restrict closing_speed,
+                   double *restrict ttc, size_t begin, size_t end);
+
+/**
+ * @brief Find intervals of at least <b>min_len</b> samples where <b>x</b> is below <b>threshold</b>.
+ *
+ * @param events - destination of at most <b>max_events</b> intervals
+ * @return number of intervals found, intervals beyond <b>max_events</b> are counted only
+ */
+size_t analytics_detect_events(const double *x, size_t n, double threshold, size_t min_len,
+                               analytics_event *events, size_t max_events);
+
+/**
+ * @brief Run <b>kernel</b> on [0, n) split into equal ranges over <b>threads</b> worker threads.
+ *
+ * @param kernel - called with the range of a worker and <b>context</b>
+ * @param threads - number of workers, 1 runs the kernel on the calling thread
+ */
+void analytics_parallel(size_t n, size_t threads,
+                        void (*kernel)(size_t begin, size_t end, void *context), void *context);
+
+#endif //__ANALYTICS_H__
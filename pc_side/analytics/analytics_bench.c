@@ -0,0 +1,141 @@
+/* Scaling benchmark of the analytics kernels.
+
+   A synthetic log of a long session is generated: throttle steps, the motor following them
+   with a first order lag behind a dead time, and a distance closing and opening with sensor
+   noise. The derivation of analytics_cli.c is timed at 1, 2, 4, ... threads up to the number
+   of cores. The results must not depend on the number of threads, and the latency found by the
+   cross-correlation must be between the injected dead time and the dead time plus three time
+   constants.
+
+   build: cc -O3 -march=native -I. analytics_bench.c analytics.c -lpthread -lm -o analytics_bench
+   usage: ./analytics_bench [rows] [max_threads]
+*/
+#include "analytics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATE_HZ 1000.0
+#define DEAD_TIME_MS 60
+#define TIME_CONSTANT_MS 100
+#define SMOOTH_HALF 25
+//searched beyond the accepted latency, so a wrong peak is caught
+#define MAX_LAG 500
+
+typedef struct signals{
+    size_t n;
+    double *t;
+    double *rpm;
+    double *throttle;
+    double *distance;
+    double *rpm_f;
+    double *throttle_f;
+    double *distance_f;
+    double *accel;
+    double *closing;
+    double *ttc;
+    const double *taps;
+} signals;
+
+static void smooth(size_t begin, size_t end, void *context)
+{
+    signals *s = context;
+    analytics_fir(s->rpm, s->rpm_f, s->n, s->taps, SMOOTH_HALF, begin, end);
+    analytics_fir(s->throttle, s->throttle_f, s->n, s->taps, SMOOTH_HALF, begin, end);
+    analytics_fir(s->distance, s->distance_f, s->n, s->taps, SMOOTH_HALF, begin, end);
+}
+
+static void derive(size_t begin, size_t end, void *context)
+{
+    signals *s = context;
+    analytics_diff(s->t, s->rpm_f, s->accel, s->n, begin, end);
+    analytics_diff(s->t, s->distance_f, s->closing, s->n, begin, end);
+    for(size_t i = begin; i < end; i++)
+    {
+        s->closing[i] = -s->closing[i];
+    }
+    analytics_ttc(s->distance_f, s->closing, s->ttc, begin, end);
+}
+
+static double *column(size_t n)
+{
+    double *data = calloc(n, sizeof(double));
+    if(data == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return data;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 3600 * (size_t)RATE_HZ;
+    size_t max_threads = argc > 2 ? strtoull(argv[2], NULL, 10) : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 2 * MAX_LAG + 2 || max_threads < 1)
+    {
+        fprintf(stderr, "at least %d rows and 1 thread are needed\n", 2 * MAX_LAG + 2);
+        return 1;
+    }
+    signals s = {.n = n, .t = column(n), .rpm = column(n), .throttle = column(n), .distance = column(n),
+                 .rpm_f = column(n), .throttle_f = column(n), .distance_f = column(n),
+                 .accel = column(n), .closing = column(n), .ttc = column(n)};
+    double taps[2 * SMOOTH_HALF + 1];
+    analytics_boxcar(taps, SMOOTH_HALF);
+    s.taps = taps;
+    srand(1);
+    size_t dead = DEAD_TIME_MS * RATE_HZ / 1000;
+    size_t latency_max = (DEAD_TIME_MS + 3 * TIME_CONSTANT_MS) * RATE_HZ / 1000;
+    double throttle = 0, rpm = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        s.t[i] = i / RATE_HZ;
+        if(rand() % 2000 == 0)
+        {
+            throttle = rand() % 100;
+        }
+        s.throttle[i] = throttle;
+        //the motor follows the throttle of the dead time earlier with a first order lag
+        double target = 150 * (i >= dead ? s.throttle[i - dead] : 0);
+        rpm += (target - rpm) / (TIME_CONSTANT_MS * RATE_HZ / 1000);
+        s.rpm[i] = rpm + (rand() % 100 - 50);
+        s.distance[i] = 1.2 + sin(s.t[i] * 0.5) + (rand() % 100 - 50) * 1e-4;
+    }
+    printf("rows=%zu (%.1f h at %g Hz)\n", n, n / RATE_HZ / 3600, RATE_HZ);
+    double *reference = column(n);
+    double base = 0;
+    for(size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double start = now_s();
+        analytics_parallel(n, threads, smooth, &s);
+        analytics_parallel(n, threads, derive, &s);
+        double filtered = now_s();
+        double correlation = 0;
+        long lag = analytics_xcorr_lag(s.throttle_f, s.rpm_f, n, MAX_LAG, threads, &correlation);
+        double elapsed = now_s() - start;
+        if(threads == 1)
+        {
+            base = elapsed;
+            memcpy(reference, s.ttc, n * sizeof(double));
+        }
+        bool same = memcmp(reference, s.ttc, n * sizeof(double)) == 0 && lag >= (long)dead && lag <= (long)latency_max;
+        printf("threads=%3zu filter+derive=%8.3fs xcorr=%8.3fs total=%8.3fs speedup=%5.2f lag=%ldms %s\n",
+               threads, filtered - start, elapsed - (filtered - start), elapsed, base / elapsed,
+               (long)(lag * 1000 / RATE_HZ), same ? "" : "MISMATCH");
+        if(!same)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
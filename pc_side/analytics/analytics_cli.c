@@ -0,0 +1,217 @@
+/* Derived signals of a recorded session.
+
+   The columns of a measurements log are resampled onto a uniform grid and smoothed, then the
+   acceleration, the closing speed, the time to collision and the braking events are derived,
+   and the latency of the motor behind the throttle input is estimated by cross-correlation.
+   The derived columns are written to a csv, the summary to stdout.
+
+   build: cc -O3 -march=native -I. analytics_cli.c analytics.c -lpthread -lm -o analytics
+   usage: ./analytics [-r rate_hz] [-s smooth_ms] [-w m_per_rev] [-b brake_threshold]
+                      [-l max_lag_ms] [-j threads] [-o derived.csv] measurements.csv
+*/
+#include "analytics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+//column names written by the firmware and telemetry_ingest.py
+#define COLUMN_TIME "time[us]"
+#define COLUMN_RPM "rot/min"
+#define COLUMN_THROTTLE "throttle in duty[%]"
+#define COLUMN_DISTANCE "distance[m]"
+#define MAX_EVENTS 1024
+
+typedef struct columns{
+    double *t;
+    double *rpm;
+    double *throttle;
+    double *distance;
+    double *accel;
+    double *closing;
+    double *ttc;
+} columns;
+
+typedef struct stage{
+    const columns *src;
+    columns *dst;
+    size_t n;
+    const double *taps;
+    size_t half;
+} stage;
+
+static void smooth_kernel(size_t begin, size_t end, void *context)
+{
+    stage *s = context;
+    analytics_fir(s->src->rpm, s->dst->rpm, s->n, s->taps, s->half, begin, end);
+    analytics_fir(s->src->throttle, s->dst->throttle, s->n, s->taps, s->half, begin, end);
+    analytics_fir(s->src->distance, s->dst->distance, s->n, s->taps, s->half, begin, end);
+}
+
+static void derive_kernel(size_t begin, size_t end, void *context)
+{
+    stage *s = context;
+    analytics_diff(s->src->t, s->src->rpm, s->dst->accel, s->n, begin, end);
+    analytics_diff(s->src->t, s->src->distance, s->dst->closing, s->n, begin, end);
+    for(size_t i = begin; i < end; i++)
+    {
+        s->dst->closing[i] = -s->dst->closing[i];
+    }
+    analytics_ttc(s->src->distance, s->dst->closing, s->dst->ttc, begin, end);
+}
+
+typedef struct resample_context{
+    const double *t;
+    const double *in[3];
+    double *out[3];
+    size_t rows;
+    double t0;
+    double dt;
+} resample_context;
+
+static void resample_kernel(size_t begin, size_t end, void *context)
+{
+    resample_context *r = context;
+    for(int c = 0; c < 3; c++)
+    {
+        analytics_resample(r->t, r->in[c], r->rows, r->t0, r->dt, r->out[c], begin, end);
+    }
+}
+
+static double *column(size_t n)
+{
+    double *data = malloc(n * sizeof(double));
+    if(data == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    double rate_hz = 100, smooth_ms = 100, m_per_rev = 0, brake_threshold = 2000, max_lag_ms = 500;
+    size_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_path = "derived.csv";
+    int opt;
+    while((opt = getopt(argc, argv, "r:s:w:b:l:j:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r': rate_hz = atof(optarg); break;
+            case 's': smooth_ms = atof(optarg); break;
+            case 'w': m_per_rev = atof(optarg); break;
+            case 'b': brake_threshold = atof(optarg); break;
+            case 'l': max_lag_ms = atof(optarg); break;
+            case 'j': threads = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-r rate_hz] [-s smooth_ms] [-w m_per_rev] [-b brake_threshold]"
+                        " [-l max_lag_ms] [-j threads] [-o derived.csv] measurements.csv\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc || !(rate_hz > 0))
+    {
+        fprintf(stderr, "missing log or invalid rate\n");
+        return 1;
+    }
+    analytics_table table;
+    if(!analytics_table_load(argv[optind], &table))
+    {
+        fprintf(stderr, "can not load %s\n", argv[optind]);
+        return 1;
+    }
+    const double *time_us = analytics_table_column(&table, COLUMN_TIME);
+    resample_context resample = {
+        .in = {
+            analytics_table_column(&table, COLUMN_RPM),
+            analytics_table_column(&table, COLUMN_THROTTLE),
+            analytics_table_column(&table, COLUMN_DISTANCE),
+        },
+        .rows = table.rows,
+        .dt = 1.0 / rate_hz,
+    };
+    if(time_us == NULL || resample.in[0] == NULL || resample.in[1] == NULL || resample.in[2] == NULL || table.rows < 2)
+    {
+        fprintf(stderr, "%s misses columns or rows\n", argv[optind]);
+        return 1;
+    }
+    //seconds from the first sample, the device clock wraps only after 292 thousand years
+    double *t_in = column(table.rows);
+    for(size_t i = 0; i < table.rows; i++)
+    {
+        t_in[i] = (time_us[i] - time_us[0]) * 1e-6;
+    }
+    resample.t = t_in;
+    size_t n = (size_t)(t_in[table.rows - 1] / resample.dt) + 1;
+    if(n < 2)
+    {
+        fprintf(stderr, "log is shorter than a period\n");
+        return 1;
+    }
+    columns raw = {.t = column(n), .rpm = column(n), .throttle = column(n), .distance = column(n)};
+    columns filtered = {.t = raw.t, .rpm = column(n), .throttle = column(n), .distance = column(n),
+                        .accel = column(n), .closing = column(n), .ttc = column(n)};
+    for(size_t i = 0; i < n; i++)
+    {
+        raw.t[i] = i * resample.dt;
+    }
+    resample.out[0] = raw.rpm;
+    resample.out[1] = raw.throttle;
+    resample.out[2] = raw.distance;
+    analytics_parallel(n, threads, resample_kernel, &resample);
+
+    size_t half = (size_t)(smooth_ms * 1e-3 * rate_hz / 2);
+    double *taps = column(2 * half + 1);
+    analytics_boxcar(taps, half);
+    stage smooth = {.src = &raw, .dst = &filtered, .n = n, .taps = taps, .half = half};
+    analytics_parallel(n, threads, smooth_kernel, &smooth);
+    stage derive = {.src = &filtered, .dst = &filtered, .n = n};
+    analytics_parallel(n, threads, derive_kernel, &derive);
+
+    double correlation = 0;
+    long max_lag = (long)(max_lag_ms * 1e-3 * rate_hz);
+    max_lag = max_lag < (long)n - 2 ? max_lag : (long)n - 2;
+    long lag = analytics_xcorr_lag(filtered.throttle, filtered.rpm, n, max_lag, threads, &correlation);
+    printf("rows=%zu resampled=%zu rate=%gHz threads=%zu\n", table.rows, n, rate_hz, threads);
+    printf("throttle->rpm latency=%.1fms correlation=%.3f\n", lag * resample.dt * 1e3, correlation);
+
+    //braking: the wheel decelerates faster than the threshold for at least a smoothing window
+    analytics_event events[MAX_EVENTS];
+    size_t found = analytics_detect_events(filtered.accel, n, -brake_threshold, half > 0 ? half : 1, events, MAX_EVENTS);
+    printf("braking events=%zu\n", found);
+    for(size_t e = 0; e < found && e < MAX_EVENTS; e++)
+    {
+        double min_ttc = INFINITY;
+        for(size_t i = events[e].begin; i < events[e].end; i++)
+        {
+            min_ttc = filtered.ttc[i] < min_ttc ? filtered.ttc[i] : min_ttc;
+        }
+        printf("  t=%.3fs..%.3fs peak=%.0frpm/s", raw.t[events[e].begin], raw.t[events[e].end - 1], events[e].peak);
+        if(m_per_rev > 0)
+        {
+            printf(" (%.2fm/s2)", events[e].peak * m_per_rev / 60);
+        }
+        printf(" min_ttc=%.2fs\n", min_ttc);
+    }
+
+    FILE *out = fopen(out_path, "w");
+    if(out == NULL)
+    {
+        fprintf(stderr, "can not write %s\n", out_path);
+        return 1;
+    }
+    fprintf(out, "time[s], rot/min, throttle in duty[%%], distance[m], accel[rpm/s], accel[m/s2], closing speed[m/s], ttc[s]\n");
+    for(size_t i = 0; i < n; i++)
+    {
+        fprintf(out, "%.6f, %f, %f, %f, %f, %f, %f, %f\n", filtered.t[i], filtered.rpm[i], filtered.throttle[i],
+                filtered.distance[i], filtered.accel[i], filtered.accel[i] * m_per_rev / 60,
+                filtered.closing[i], filtered.ttc[i]);
+    }
+    fclose(out);
+    printf("derived columns written to %s\n", out_path);
+    analytics_table_free(&table);
+    return 0;
+}
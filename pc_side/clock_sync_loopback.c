@@ -0,0 +1,77 @@
+/* Loopback check of the clock synchronisation of main/clock_sync.c.
+
+   A device clock with an offset and a drift against the host clock is simulated together with
+   an asymmetric link with random queueing delays and a device that sometimes polls its socket
+   late. The ping-pong exchange of the firmware is run through the unchanged estimator, and
+   the achieved error of the device to host mapping is compared to the stated error bound.
+
+   build: cc -O2 -I../main clock_sync_loopback.c ../main/clock_sync.c -lm -o clock_sync_loopback
+   usage: ./clock_sync_loopback [drift_ppm] [exchanges]
+*/
+#include "clock_sync.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+//one way delay of the link: base + exponential queueing delay [us]
+static double link_delay(double base_us, double mean_queueing_us)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return base_us - mean_queueing_us * log(u);
+}
+
+int main(int argc, char **argv)
+{
+    double drift_ppm = argc > 1 ? atof(argv[1]) : 40.0;
+    int exchanges = argc > 2 ? atoi(argv[2]) : 600;
+    //host time = device time * (1 + drift) + offset, host clock is the reference
+    const double offset_us = 1.7e15;
+    const double rate = 1 + drift_ppm * 1e-6;
+    clock_sync cs;
+    clock_sync_reset(&cs);
+    srand(1);
+    double max_error = 0, sum_error2 = 0;
+    int within_bound = 0, synced = 0, stale_accepted = 0;
+    char msg[CLOCK_SYNC_MSG_SIZE];
+    for(int i = 0; i < exchanges; i++)
+    {
+        double host_t = offset_us + 10e6 + i * CLOCK_SYNC_PERIOD_MS * 1e3;
+        double t1 = (host_t - offset_us) / rate;
+        clock_sync_ping(&cs, (int64_t)t1, msg);
+        //Wi-Fi uplink is slower and noisier than the downlink, the host answers in 50 us
+        double t2 = host_t + link_delay(1500, 2000);
+        double t3 = t2 + 50;
+        double arrival = t3 + link_delay(900, 800);
+        //every tenth answer is read by a late socket poll
+        if(rand() % 10 == 0)
+        {
+            arrival += rand() % (CLOCK_SYNC_TIMEOUT_MS * 1000);
+        }
+        int64_t t4 = (int64_t)((arrival - offset_us) / rate);
+        snprintf(msg, sizeof(msg), "pong %"PRIu32" %"PRId64" %"PRId64" %"PRId64,
+                 cs.seq, (int64_t)t1, (int64_t)t2, (int64_t)t3);
+        clock_sync_pong(&cs, msg, t4);
+        //a repeated answer and one with a mangled send time must both be ignored
+        stale_accepted += clock_sync_pong(&cs, msg, t4 + 1000);
+        snprintf(msg, sizeof(msg), "pong %"PRIu32" %"PRId64" %"PRId64" %"PRId64,
+                 cs.seq, (int64_t)t1 - 5000, (int64_t)t2, (int64_t)t3);
+        stale_accepted += clock_sync_pong(&cs, msg, t4);
+        if(!cs.estimate.synced)
+        {
+            continue;
+        }
+        //error of mapping a timestamp half a period after the exchange
+        double device_t = t4 + CLOCK_SYNC_PERIOD_MS * 500.0;
+        double error = (double)clock_sync_to_client(&cs, (int64_t)device_t) - (device_t * rate + offset_us);
+        max_error = fmax(max_error, fabs(error));
+        sum_error2 += error * error;
+        within_bound += fabs(error) <= cs.estimate.error_us;
+        synced++;
+    }
+    printf("exchanges: %d, synced: %d, stale pongs accepted: %d\n", exchanges, synced, stale_accepted);
+    printf("drift: simulated %.3f ppm, estimated %.3f ppm\n", drift_ppm, cs.estimate.drift_ppb * 1e-3);
+    printf("mapping error: rms %.1f us, max %.1f us\n", sqrt(sum_error2 / (synced ? synced : 1)), max_error);
+    printf("stated error bound: last %"PRIu32" us, held for %.1f%% of the exchanges\n",
+           cs.estimate.error_us, 100.0 * within_bound / (synced ? synced : 1));
+    return 0;
+}
@@ -0,0 +1,141 @@
+/* Replay of a recorded log through the filter stage of main/sensor_filter.c.
+
+   The rows of a measurements csv are passed through the unchanged sensor_filter_step() in time
+   order, and the derived fields are written next to the recorded ones. Spikes can be injected
+   into the recorded distances to check the outlier gate on logs without many of them. The
+   replay is repeated to time a filter step on the host.
+
+   build: cc -O2 -Ihost_include -I../main -Ianalytics filter_replay.c ../main/sensor_filter.c analytics/analytics.c -lpthread -lm -o filter_replay
+   usage: ./filter_replay [-p spike_prob] [-s seed] [-r repeats] [-o filtered.csv] measurements.csv
+*/
+#include "sensor_filter.h"
+#include "analytics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    double spike_prob = 0;
+    unsigned seed = 1;
+    long repeats = 1000;
+    const char *out_path = "filtered.csv";
+    int opt;
+    while((opt = getopt(argc, argv, "p:s:r:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'p': spike_prob = atof(optarg); break;
+            case 's': seed = atoi(optarg); break;
+            case 'r': repeats = atol(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-p spike_prob] [-s seed] [-r repeats] [-o filtered.csv] measurements.csv\n", argv[0]);
+                return 1;
+        }
+    }
+    analytics_table table;
+    if(optind >= argc || !analytics_table_load(argv[optind], &table))
+    {
+        fprintf(stderr, "can not load %s\n", optind < argc ? argv[optind] : "a log");
+        return 1;
+    }
+    const double *time_us = analytics_table_column(&table, "time[us]");
+    const double *rpm = analytics_table_column(&table, "rot/min");
+    const double *throttle = analytics_table_column(&table, "throttle in duty[%]");
+    const double *distance = analytics_table_column(&table, "distance[m]");
+    measurements_data *rows = calloc(table.rows, sizeof(measurements_data));
+    bool *spiked = calloc(table.rows, sizeof(bool));
+    if(time_us == NULL || rpm == NULL || throttle == NULL || distance == NULL || rows == NULL || spiked == NULL)
+    {
+        fprintf(stderr, "%s misses columns\n", argv[optind]);
+        return 1;
+    }
+    srand(seed);
+    size_t injected = 0;
+    double last_speed_us = 0;
+    for(size_t i = 0; i < table.rows; i++)
+    {
+        rows[i].time_us = time_us[i];
+        rows[i].rot_velocity = rpm[i];
+        rows[i].throttle_in_duty = throttle[i];
+        rows[i].distance = distance[i];
+        //sample counts are not logged, a changed value or a tachometer period passed is a new reading
+        bool new_reading = i == 0 || distance[i] != distance[i - 1];
+        bool new_speed = i == 0 || rpm[i] != rpm[i - 1] || time_us[i] - last_speed_us >= VELO_MEAS_PERIOD_MS * 1000;
+        if(i > 0)
+        {
+            memcpy(rows[i].samples, rows[i - 1].samples, sizeof(rows[i].samples));
+        }
+        rows[i].samples[SENSOR_ID_hc_sr04] += new_reading;
+        if(new_speed)
+        {
+            rows[i].samples[SENSOR_ID_tachometer]++;
+            last_speed_us = time_us[i];
+        }
+        //a spike replaces a new reading, the following rows repeat it until the next one
+        if(new_reading && rand() < spike_prob * RAND_MAX)
+        {
+            rows[i].distance = distance[i] * (1.5 + rand() / (double)RAND_MAX);
+            spiked[i] = true;
+            injected++;
+        }
+        else if(!new_reading)
+        {
+            rows[i].distance = rows[i - 1].distance;
+        }
+    }
+
+    sensor_filter filter;
+    sensor_filter_reset(&filter);
+    FILE *out = fopen(out_path, "w");
+    if(out == NULL)
+    {
+        fprintf(stderr, "can not write %s\n", out_path);
+        return 1;
+    }
+    fprintf(out, "time[us], rot/min, throttle in duty[%%], distance[m], spike"
+            ", filtered distance[m], closing speed[m/s], ttc[s], ttc valid, rejected\n");
+    size_t caught = 0;
+    for(size_t i = 0; i < table.rows; i++)
+    {
+        measurements_data data = rows[i];
+        uint32_t outliers = filter.outliers;
+        sensor_filter_step(&filter, &data);
+        bool rejected = filter.outliers != outliers;
+        caught += spiked[i] && rejected;
+        fprintf(out, "%"PRIu64", %f, %f, %f, %d, %f, %f, %f, %.0f, %d\n", data.time_us, data.rot_velocity,
+                data.throttle_in_duty, data.distance, spiked[i], data.distance_filtered, data.closing_speed,
+                data.ttc, data.ttc_valid, rejected);
+    }
+    fclose(out);
+    printf("rows=%zu rejected=%"PRIu32" injected spikes=%zu caught=%zu, written to %s\n",
+           table.rows, filter.outliers, injected, caught, out_path);
+
+    double start = now_s();
+    //keeps the replays from being optimised away
+    volatile float sink = 0;
+    for(long r = 0; r < repeats; r++)
+    {
+        sensor_filter_reset(&filter);
+        for(size_t i = 0; i < table.rows; i++)
+        {
+            measurements_data data = rows[i];
+            sensor_filter_step(&filter, &data);
+            sink += data.ttc;
+        }
+    }
+    double elapsed = now_s() - start;
+    printf("%.1f ns per step over %ld replays\n", elapsed * 1e9 / (repeats * (double)table.rows), repeats);
+    analytics_table_free(&table);
+    return 0;
+}
@@ -0,0 +1,14 @@
+/* Host stand-in for the esp-idf error codes, lets the host tools include the firmware headers
+   of modules without esp-idf dependencies, e.g. main/sensors.h for measurements_data. */
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NOT_SUPPORTED 0x106
+
+#endif
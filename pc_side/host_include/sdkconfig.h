@@ -0,0 +1,8 @@
+/* Host stand-in for the sdkconfig.h generated by the esp-idf build, holds the defaults of the
+   main/Kconfig.projbuild options read by the firmware headers the host tools include. */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_RC_CAR_WHEEL_CIRCUMFERENCE_MM 204
+
+#endif
@@ -0,0 +1,192 @@
+"""Collect the telemetry stream of the rc car and rewrite its timestamps into host time.
+
+The ingester answers the '#ping' messages of the device (see main/clock_sync.h) with host
+timestamps, follows the '#sync' estimates the device reports back, and writes every record
+with its host time and the error bound of that time. Rows received before the clock is
+synchronised are held back until the first estimate arrives.
+
+Bursts of raw capture events uploaded by the device (see main/burst.h) are written to a
+separate file, one row per event with its full device time restored from the 32 bit
+timestamp and mapped into host time.
+
+Besides the records, the accuracy achieved on the link is reported at the end: for every ping
+the one way delay from the device to the host is computed as host receive time minus the
+mapped device send time. A mapping error shows up as negative delays, and the minimum delay
+is the Wi-Fi delivery latency.
+
+usage: python telemetry_ingest.py <esp32 ip> [-p 3333] [-o measurements.csv] [-c "set format bin" ...]
+stop collection with Ctrl+C.
+"""
+import argparse
+import socket
+import statistics
+import struct
+import time
+
+SYNC_BYTE = 0xA5
+RECORD_MEASUREMENTS = 0x01
+RECORD_AGGREGATE = 0x02
+
+
+def now_us():
+    return time.time_ns() // 1000
+
+
+class ClockMapping:
+    """Device to host time mapping reported by '#sync ref offset drift_ppb error synced'."""
+
+    def __init__(self):
+        self.synced = False
+        self.ref = self.offset = self.drift_ppb = self.error = 0
+
+    def update(self, fields):
+        self.ref, self.offset, self.drift_ppb, self.error = (int(f) for f in fields[:4])
+        self.synced = fields[4] == '1'
+
+    def to_host(self, device_us):
+        return device_us + self.offset + (device_us - self.ref) * self.drift_ppb // 1_000_000_000
+
+
+class Ingester:
+    def __init__(self, sock, raw_out, aggregate_out, burst_out):
+        self.sock = sock
+        self.raw_out = raw_out
+        self.aggregate_out = aggregate_out
+        self.burst_out = burst_out
+        self.burst_out.write('burst, trigger, host_time[us], time[us], cap_ticks, sensor, edge\n')
+        # id, trigger and trigger time of the burst being received
+        self.burst = None
+        self.clock = ClockMapping()
+        self.buffer = b''
+        self.field_count = 0
+        self.pending = []
+        # (device send time, host receive time) of every ping
+        self.pings = []
+
+    def send(self, line):
+        self.sock.sendall((line + '\n').encode('ascii'))
+
+    def write(self, device_us, values):
+        """Write a record, or hold it back while the clock is not synchronised."""
+        if not self.clock.synced:
+            self.pending.append((device_us, values))
+            return
+        for held_us, held_values in self.pending:
+            self._write(held_us, held_values)
+        self.pending.clear()
+        self._write(device_us, values)
+
+    def _write(self, device_us, values):
+        out = self.raw_out if values[1] == 1 else self.aggregate_out
+        host_us = self.clock.to_host(device_us)
+        out.write(', '.join(str(v) for v in [host_us, self.clock.error, device_us, *values]) + '\n')
+
+    def handle_line(self, line, rx_us):
+        if line.startswith('#ping'):
+            _, seq, t1 = line.split()
+            self.send(f'pong {seq} {t1} {rx_us} {now_us()}')
+            self.pings.append((int(t1), rx_us))
+        elif line.startswith('#burst begin'):
+            _, _, burst_id, trigger, trigger_us, pre, post, events, truncated = line.split()
+            self.burst = (int(burst_id), trigger, int(trigger_us))
+            print(f'burst {burst_id}: {trigger}, {events} events, pre {pre} ms post {post} ms'
+                  + (', truncated' if truncated == '1' else ''))
+        elif line.startswith('#burst end'):
+            self.burst = None
+        elif line.startswith('#ev') and self.burst is not None:
+            _, time_us, cap_ticks, sensor, edge = line.split()
+            burst_id, trigger, trigger_us = self.burst
+            # events carry the low 32 bits of the device time, closest to the trigger time
+            delta = (int(time_us) - trigger_us + (1 << 31)) % (1 << 32) - (1 << 31)
+            device_us = trigger_us + delta
+            self.burst_out.write(f'{burst_id}, {trigger}, {self.clock.to_host(device_us)}, '
+                                 f'{device_us}, {cap_ticks}, {sensor}, {edge}\n')
+        elif line.startswith('#sync'):
+            self.clock.update(line.split()[1:])
+        elif line.startswith('#time[us]'):
+            self.aggregate_out.write('host_time[us], host_time_error[us], ' + line[1:] + '\n')
+        elif line.startswith('time[us]'):
+            self.field_count = len(line.split(',')) - 3
+            self.raw_out.write('host_time[us], host_time_error[us], ' + line + '\n')
+        elif line.startswith('#'):
+            print(line)
+        elif line:
+            device_us, level, count, *values = (v.strip() for v in line.split(','))
+            self.write(int(device_us), [int(level), int(count), *values])
+
+    def handle_frame(self):
+        """Decode a binary frame at the start of the buffer, return False if it is incomplete."""
+        if len(self.buffer) < 3:
+            return False
+        record_type, level = self.buffer[1], self.buffer[2]
+        if record_type == RECORD_MEASUREMENTS:
+            layout = '<Q' + 'f' * self.field_count
+        else:
+            layout = '<IQQ' + 'f' * 4 * self.field_count
+        size = 3 + struct.calcsize(layout)
+        if len(self.buffer) < size:
+            return False
+        values = struct.unpack(layout, self.buffer[3:size])
+        self.buffer = self.buffer[size:]
+        if record_type == RECORD_MEASUREMENTS:
+            self.write(values[0], [level, 1, *values[1:]])
+        else:
+            # time of the last sample, like the csv rows
+            self.write(values[2], [level, values[0], *values[3:]])
+        return True
+
+    def receive(self):
+        data = self.sock.recv(4096)
+        rx_us = now_us()
+        if not data:
+            raise ConnectionError('connection closed by the device')
+        self.buffer += data
+        while self.buffer:
+            if self.buffer[0] == SYNC_BYTE:
+                if not self.handle_frame():
+                    return
+                continue
+            end = self.buffer.find(b'\n')
+            if end < 0:
+                return
+            line = self.buffer[:end].decode('ascii').strip()
+            self.buffer = self.buffer[end + 1:]
+            self.handle_line(line, rx_us)
+
+    def report(self):
+        delays = [rx - self.clock.to_host(t1) for t1, rx in self.pings]
+        print(f'clock: synced={self.clock.synced} drift={self.clock.drift_ppb * 1e-3:.3f} ppm '
+              f'stated error bound={self.clock.error} us')
+        if self.clock.synced and delays:
+            print(f'device to host delay over {len(delays)} pings [us]: min {min(delays)}, '
+                  f'median {statistics.median(delays)}, max {max(delays)}')
+            print(f'mapping error observed: {max(0, -min(delays))} us (delays below zero)')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='esp32 IP address')
+    parser.add_argument('-p', '--port', type=int, default=3333)
+    parser.add_argument('-o', '--output', default='measurements.csv')
+    parser.add_argument('-c', '--command', action='append', default=[], help='command sent after connecting')
+    args = parser.parse_args()
+    aggregate_path = args.output.replace('.csv', '') + '_aggregate.csv'
+    burst_path = args.output.replace('.csv', '') + '_burst.csv'
+    with socket.create_connection((args.host, args.port)) as sock, \
+            open(args.output, 'w') as raw_out, open(aggregate_path, 'w') as aggregate_out, \
+            open(burst_path, 'w') as burst_out:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        ingester = Ingester(sock, raw_out, aggregate_out, burst_out)
+        for command in args.command:
+            ingester.send(command)
+        print('Start receiving')
+        try:
+            while True:
+                ingester.receive()
+        except (KeyboardInterrupt, ConnectionError) as stop:
+            print(f'End receiving: {stop or "interrupted"}')
+        ingester.report()
+
+
+if __name__ == '__main__':
+    main()
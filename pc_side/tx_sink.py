@@ -0,0 +1,83 @@
+"""Measure the saturated telemetry throughput of the rc car transmit backend.
+
+The sink connects to the device, sends the optional commands (e.g. "set format bin"), requests
+'txbench <seconds>' (see main/tcp_server.h) and drains the socket as fast as it can. The bytes
+received between the '#ok txbench' reply and the closing '#txbench' line are counted on the
+host, and the device report with the encode and transmit cycles per byte is printed next to them.
+
+The backend is chosen at build time with RC_CAR_TX_BACKEND, flash each backend and run the sink
+against it with the same output file to get one row per backend and format.
+
+usage: python tx_sink.py <esp32 ip> [-p 3333] [-t 10] [-c "set format bin" ...] [-o tx_bench.csv]
+"""
+import argparse
+import os
+import socket
+import time
+
+RECV_SIZE = 1 << 16
+
+
+def read_until(sock, buffer, marker):
+    """Receive until marker is found, return the data before it and the data after it."""
+    while marker not in buffer:
+        data = sock.recv(RECV_SIZE)
+        if not data:
+            raise ConnectionError('connection closed before ' + marker.decode().strip())
+        buffer += data
+    return buffer.split(marker, 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='esp32 IP address')
+    parser.add_argument('-p', '--port', type=int, default=3333)
+    parser.add_argument('-t', '--seconds', type=int, default=10, help='duration of the benchmark (1-60)')
+    parser.add_argument('-c', '--command', action='append', default=[], help='command sent before the benchmark')
+    parser.add_argument('-o', '--output', default='tx_bench.csv', help='csv the results are appended to')
+    args = parser.parse_args()
+
+    with socket.create_connection((args.host, args.port)) as sock:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)
+        # the boot line closes the greeting of the device
+        _, rest = read_until(sock, b'', b'#boot')
+        _, rest = read_until(sock, rest, b'\n')
+        for command in args.command:
+            sock.sendall(command.encode() + b'\n')
+        sock.sendall(b'txbench %d\n' % args.seconds)
+        _, rest = read_until(sock, rest, b'#ok txbench')
+        _, rest = read_until(sock, rest, b'\n')
+        start = time.monotonic()
+        received = len(rest)
+        # only a tail is kept, the marker may be split between two receives
+        tail = rest
+        marker = b'#txbench backend='
+        while marker not in tail:
+            data = sock.recv(RECV_SIZE)
+            if not data:
+                raise ConnectionError('connection closed during the benchmark')
+            received += len(data)
+            tail = tail[-len(marker):] + data
+        elapsed = time.monotonic() - start
+        before, report = tail.split(marker, 1)
+        report, _ = read_until(sock, report, b'\n')
+        report = b'backend=' + report
+        # the marker and the report are not part of the benchmark data
+        received -= len(tail) - len(before)
+
+    fields = dict(field.split('=', 1) for field in report.decode().split())
+    host_kbps = received / elapsed / 1000
+    print(f"backend={fields['backend']} host: {received} B in {elapsed:.2f} s, {host_kbps:.1f} kB/s")
+    print(f"device: {fields['bytes']} B in {fields['ms']} ms, {fields['kBps']} kB/s, "
+          f"encode {fields['encode_cpb']} cycles/B, transmit {fields['tx_cpb']} cycles/B")
+
+    new_file = not os.path.exists(args.output)
+    with open(args.output, 'a') as out:
+        if new_file:
+            out.write('backend, commands, host_kBps, device_kBps, encode_cpb, tx_cpb\n')
+        out.write(f"{fields['backend']}, {' / '.join(args.command)}, {host_kbps:.1f}, "
+                  f"{fields['kBps']}, {fields['encode_cpb']}, {fields['tx_cpb']}\n")
+
+
+if __name__ == '__main__':
+    main()
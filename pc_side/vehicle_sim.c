@@ -0,0 +1,311 @@
+/* Closed loop simulation of the control logic of main/control_logic.c.
+
+   The unchanged control_step() of the firmware drives a plant model in discrete time steps of
+   SIM_STEP_US without any sleeping, so a scenario of several seconds takes microseconds to
+   milliseconds of CPU. The model follows the signal chain of the car:
+   - speed controller: the duty cycle applied by set_throttle_duty() is latched once per PWM
+     period, the motor speed follows the commanded speed with a first order lag
+   - tachometer: edges are counted and read every VELO_MEAS_PERIOD_MS, converted to rot/min by
+     tacho_counts_to_rpm() of main/sensor_conversions.h, like in sensors.c
+   - HC-SR04: triggered every DISTANCE_MEAS_PERIOD_MS, the echo arrives after the time of flight
+     quantised to APB clock ticks and converted by echo_ticks_to_m(), with gaussian timing noise
+     and random multipath spikes, no echo beyond the range of the sensor leaves the last value
+     in place
+   - driver: opens the throttle, and releases it after a reaction time once the obstacle is
+     closer than their braking distance, or never if it is 0
+   - control loop: every LOOP_PERIOD_MS the previous output is applied, the measurements are
+     sampled and passed through the filter stage of main/sensor_filter.c, and the next output
+     is computed, measurements time out with a set probability
+
+   Scenarios draw the initial distance, the throttle and the braking distance of the driver at
+   random and run in parallel on worker threads. A scenario ends with a collision or after the
+   simulated duration, one result row per scenario is written to the output csv.
+
+   build: cc -O2 -Ihost_include -I../main vehicle_sim.c ../main/control_logic.c ../main/sensor_filter.c -lpthread -lm -o vehicle_sim
+   usage: ./vehicle_sim [-n scenarios] [-j threads] [-d duration_s] [-s seed] [-p spike_prob]
+                        [-t timeout_prob] [-o scenarios.csv]
+*/
+#include "control_logic.h"
+#include "sensor_filter.h"
+#include "sensor_conversions.h"
+#include "control_channel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define SIM_STEP_US 100
+#define SIM_MAX_THREADS 256
+//speed controller: 2 ms pulse is full forward, rot/min follows with this time constant
+#define ESC_FULL_DUTY (2e-3 * PWM_FREQ * 100)
+#define ESC_TAU_S 0.15
+#define APB_CLK_HZ 80000000
+#define SOUND_SPEED 343.0
+#define HC_SR04_RANGE_M 4.0
+#define HC_SR04_NOISE_US 20.0
+#define DRIVER_START_S 0.5
+#define DRIVER_REACTION_S 0.25
+
+typedef struct scenario{
+    double distance_m;
+    double throttle;
+    double brake_distance_m;
+} scenario;
+
+typedef struct result{
+    bool collided;
+    double collision_s;
+    double impact_speed;
+    double min_distance_m;
+    double final_distance_m;
+    uint32_t timeouts;
+} result;
+
+typedef struct sim_config{
+    size_t scenarios;
+    double duration_s;
+    uint64_t seed;
+    double spike_prob;
+    double timeout_prob;
+    scenario *inputs;
+    result *results;
+    atomic_size_t next;
+} sim_config;
+
+//xorshift64*, every scenario has its own generator so the results do not depend on the threads
+static double uniform(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) * 0x1.0p-53;
+}
+
+static double gaussian(uint64_t *state)
+{
+    double u = uniform(state) + 0x1.0p-54;
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * uniform(state));
+}
+
+static uint64_t seed_of(uint64_t seed, size_t index)
+{
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (z ^ (z >> 31)) | 1;
+}
+
+static double commanded_rpm(double duty)
+{
+    double command = (duty - THROTTLE_STATIONARY_DUTY) / (ESC_FULL_DUTY - THROTTLE_STATIONARY_DUTY);
+    command = command > 1 ? 1 : (command < -1 ? -1 : command);
+    return command * ROT_VEL_MAX;
+}
+
+static result run(const sim_config *config, size_t index)
+{
+    const scenario *s = &config->inputs[index];
+    uint64_t rng = seed_of(config->seed, index);
+    const int64_t pwm_period_us = 1000000 / PWM_FREQ;
+    const int64_t end_us = config->duration_s * 1e6;
+    result r = {.min_distance_m = s->distance_m};
+    control_state control;
+    control_reset(&control);
+    sensor_filter filter;
+    sensor_filter_reset(&filter);
+    //plant
+    double distance = s->distance_m, rpm = 0, revolutions = 0;
+    double applied_duty = THROTTLE_STATIONARY_DUTY, latched_duty = THROTTLE_STATIONARY_DUTY;
+    double driver_duty = THROTTLE_STATIONARY_DUTY;
+    int64_t release_us = -1;
+    //values published by the sensor interrupts
+    measurements_data published = {.throttle_in_duty = THROTTLE_STATIONARY_DUTY};
+    long counted_edges = 0, read_edges = 0;
+    int64_t last_tacho_us = 0;
+    int64_t echo_us = -1;
+    float echo_distance = 0;
+    for(int64_t t = 0; t < end_us; t += SIM_STEP_US)
+    {
+        //driver
+        if(t == (int64_t)(DRIVER_START_S * 1e6))
+        {
+            driver_duty = THROTTLE_STATIONARY_DUTY + s->throttle * (ESC_FULL_DUTY - THROTTLE_STATIONARY_DUTY);
+        }
+        if(release_us < 0 && distance < s->brake_distance_m)
+        {
+            release_us = t + DRIVER_REACTION_S * 1e6;
+        }
+        if(release_us >= 0 && t >= release_us)
+        {
+            driver_duty = THROTTLE_STATIONARY_DUTY;
+        }
+        //PWM edges: the receiver output is captured, the speed controller latches its input
+        if(t % pwm_period_us < SIM_STEP_US)
+        {
+            published.throttle_in_duty = driver_duty;
+            latched_duty = applied_duty;
+        }
+        //plant dynamics
+        rpm += (commanded_rpm(latched_duty) - rpm) * (SIM_STEP_US * 1e-6 / ESC_TAU_S);
+        double rev_step = rpm / 60 * SIM_STEP_US * 1e-6;
+        revolutions += fabs(rev_step);
+        distance -= rev_step * TACHO_M_PER_REVOLUTION;
+        counted_edges = (long)(revolutions * TACHO_COUNTS_PER_REVOLUTION);
+        r.min_distance_m = distance < r.min_distance_m ? distance : r.min_distance_m;
+        if(distance <= 0)
+        {
+            r.collided = true;
+            r.collision_s = t * 1e-6;
+            r.impact_speed = rpm / 60 * TACHO_M_PER_REVOLUTION;
+            break;
+        }
+        //tachometer reading
+        if(t % (VELO_MEAS_PERIOD_MS * 1000) == 0 && t > 0)
+        {
+            tacho_raw raw = {
+                .counts = counted_edges - read_edges,
+                .interval_us = t - last_tacho_us,
+            };
+            read_edges = counted_edges;
+            published.rot_velocity = tacho_counts_to_rpm(raw);
+            published.samples[SENSOR_ID_tachometer]++;
+            last_tacho_us = t;
+        }
+        //HC-SR04 trigger and echo capture
+        if(t % (DISTANCE_MEAS_PERIOD_MS * 1000) == 0)
+        {
+            double measured = uniform(&rng) < config->spike_prob ? distance * (1.5 + uniform(&rng)) : distance;
+            double tof_s = 2 * measured / SOUND_SPEED + HC_SR04_NOISE_US * 1e-6 * gaussian(&rng);
+            if(measured < HC_SR04_RANGE_M && tof_s > 0)
+            {
+                uint32_t ticks = tof_s * APB_CLK_HZ;
+                echo_us = t + tof_s * 1e6;
+                echo_distance = echo_ticks_to_m(ticks, APB_CLK_HZ);
+            }
+        }
+        if(echo_us >= 0 && t >= echo_us)
+        {
+            published.distance = echo_distance;
+            published.samples[SENSOR_ID_hc_sr04]++;
+            echo_us = -1;
+        }
+        //control loop, the output computed in the previous period is applied first
+        if(t % (LOOP_PERIOD_MS * 1000) == 0)
+        {
+            applied_duty = control.out_duty;
+            measurements_data data = published;
+            data.time_us = t;
+            sensor_filter_step(&filter, &data);
+            bool timeout = uniform(&rng) < config->timeout_prob;
+            r.timeouts += timeout;
+            control_step(&control, timeout ? NULL : &data);
+        }
+    }
+    r.final_distance_m = distance;
+    return r;
+}
+
+static void *worker(void *arg)
+{
+    sim_config *config = arg;
+    size_t index;
+    while((index = atomic_fetch_add(&config->next, 1)) < config->scenarios)
+    {
+        config->results[index] = run(config, index);
+    }
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    sim_config config = {.scenarios = 1000, .duration_s = 10, .seed = 1, .spike_prob = 0.02, .timeout_prob = 0.001};
+    size_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_path = "scenarios.csv";
+    int opt;
+    while((opt = getopt(argc, argv, "n:j:d:s:p:t:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': config.scenarios = strtoull(optarg, NULL, 10); break;
+            case 'j': threads = strtoull(optarg, NULL, 10); break;
+            case 'd': config.duration_s = atof(optarg); break;
+            case 's': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'p': config.spike_prob = atof(optarg); break;
+            case 't': config.timeout_prob = atof(optarg); break;
+            case 'o': out_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n scenarios] [-j threads] [-d duration_s] [-s seed] [-p spike_prob]"
+                        " [-t timeout_prob] [-o scenarios.csv]\n", argv[0]);
+                return 1;
+        }
+    }
+    threads = threads < 1 ? 1 : (threads > SIM_MAX_THREADS ? SIM_MAX_THREADS : threads);
+    config.inputs = calloc(config.scenarios, sizeof(scenario));
+    config.results = calloc(config.scenarios, sizeof(result));
+    if(config.scenarios == 0 || config.inputs == NULL || config.results == NULL)
+    {
+        fprintf(stderr, "no scenarios to run\n");
+        return 1;
+    }
+    uint64_t rng = seed_of(config.seed, SIZE_MAX);
+    for(size_t i = 0; i < config.scenarios; i++)
+    {
+        config.inputs[i] = (scenario){
+            .distance_m = 1 + 3 * uniform(&rng),
+            .throttle = 0.1 + 0.9 * uniform(&rng),
+            .brake_distance_m = uniform(&rng) < 0.2 ? 0 : 1.5 * uniform(&rng),
+        };
+    }
+    atomic_init(&config.next, 0);
+    pthread_t workers[SIM_MAX_THREADS];
+    double start = now_s();
+    for(size_t i = 1; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, worker, &config);
+    }
+    worker(&config);
+    for(size_t i = 1; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    double wall = now_s() - start;
+
+    FILE *out = fopen(out_path, "w");
+    if(out == NULL)
+    {
+        fprintf(stderr, "can not write %s\n", out_path);
+        return 1;
+    }
+    fprintf(out, "scenario, distance[m], throttle, brake distance[m], collided, collision[s], impact speed[m/s],"
+            " min distance[m], final distance[m], timeouts\n");
+    size_t collisions = 0;
+    double simulated = 0, impact_sum = 0;
+    for(size_t i = 0; i < config.scenarios; i++)
+    {
+        const scenario *s = &config.inputs[i];
+        const result *r = &config.results[i];
+        fprintf(out, "%zu, %f, %f, %f, %d, %f, %f, %f, %f, %"PRIu32"\n", i, s->distance_m, s->throttle,
+                s->brake_distance_m, r->collided, r->collision_s, r->impact_speed, r->min_distance_m,
+                r->final_distance_m, r->timeouts);
+        collisions += r->collided;
+        impact_sum += r->impact_speed;
+        simulated += r->collided ? r->collision_s : config.duration_s;
+    }
+    fclose(out);
+    printf("scenarios=%zu threads=%zu collisions=%zu (%.1f%%) mean impact speed=%.2fm/s\n", config.scenarios, threads,
+           collisions, 100.0 * collisions / config.scenarios, collisions ? impact_sum / collisions : 0);
+    printf("simulated=%.0fs wall=%.3fs %.0fx real time, results written to %s\n",
+           simulated, wall, simulated / wall, out_path);
+    return 0;
+}